@@ -6,12 +6,21 @@
 #include "../src/draw.h"
 #include "../src/backend.h"
 #include "../src/utils.h"
+#include "../src/core/growable.h"
+
+struct ax_font {
+    TTF_Font* ttf;
+    struct ax_font_metrics metrics;
+};
 
 struct ax_backend {
     SDL_Window* window;
     SDL_Renderer* render;
 
     int prev_w, prev_h;
+
+    // TTF needs null terminated strings, so text is copied here before rendering
+    struct growable text_buf;
 };
 
 static void free_backend(struct ax_backend* b)
@@ -22,6 +31,7 @@ static void free_backend(struct ax_backend* b)
     if (b->window != NULL) {
         SDL_DestroyWindow(b->window);
     }
+    ax__free_growable(&b->text_buf);
     TTF_Quit();
     SDL_Quit();
 }
@@ -34,6 +44,7 @@ int ax__new_backend(struct ax_state* ax, struct ax_backend** out_bac)
         .prev_w = -999,
         .prev_h = -999,
     };
+    ax__init_growable(&b.text_buf, 256);
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         goto sdl_err;
@@ -42,8 +53,8 @@ int ax__new_backend(struct ax_state* ax, struct ax_backend** out_bac)
         goto ttf_err;
     }
     if (SDL_CreateWindowAndRenderer(
-            (int) ax->config.win_size.w,
-            (int) ax->config.win_size.h,
+            (int) AX_LENGTH_TO_DOUBLE(ax->config.win_size.w),
+            (int) AX_LENGTH_TO_DOUBLE(ax->config.win_size.h),
             SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN,
             &b.window, &b.render) != 0) {
         goto sdl_err;
@@ -113,8 +124,8 @@ bool ax__poll_event(struct ax_backend* bac, struct ax_backend_evt* be)
     SDL_GetWindowSize(bac->window, &w, &h);
     if (w != bac->prev_w || h != bac->prev_h) {
         be->ty = AX_BEVT_RESIZE;
-        be->resize_dim.w = (bac->prev_w = w);
-        be->resize_dim.h = (bac->prev_h = h);
+        be->resize_dim.w = AX_LENGTH(bac->prev_w = w);
+        be->resize_dim.h = AX_LENGTH(bac->prev_h = h);
         return true;
     }
 
@@ -144,17 +155,22 @@ void ax__render(struct ax_backend* bac,
             SDL_Color color = ax_color_to_sdl(d.r.fill);
             SDL_SetRenderDrawColor(bac->render, color.r, color.g, color.b, color.a);
             SDL_Rect r;
-            r.x = d.r.bounds.o.x;
-            r.y = d.r.bounds.o.y;
-            r.w = d.r.bounds.s.w;
-            r.h = d.r.bounds.s.h;
+            r.x = AX_LENGTH_TO_DOUBLE(d.r.bounds.o.x);
+            r.y = AX_LENGTH_TO_DOUBLE(d.r.bounds.o.y);
+            r.w = AX_LENGTH_TO_DOUBLE(d.r.bounds.s.w);
+            r.h = AX_LENGTH_TO_DOUBLE(d.r.bounds.s.h);
             SDL_RenderFillRect(bac->render, &r);
             break;
         }
 
         case AX_DRAW_TEXT: {
             SDL_Color fg = ax_color_to_sdl(d.t.color);
-            SDL_Surface* sf = TTF_RenderUTF8_Blended((void*) d.t.font, d.t.text, fg);
+            ax__growable_clear(&bac->text_buf);
+            char* line = ax__growable_extend(&bac->text_buf, d.t.len + 1);
+            line[ax__text_line_copy(d.t.text, d.t.len, line)] = '\0';
+            SDL_Surface* sf = TTF_RenderUTF8_Blended(d.t.font->ttf,
+                                                     bac->text_buf.data,
+                                                     fg);
             if (sf == NULL) {
                 goto ttf_err;
             }
@@ -164,8 +180,8 @@ void ax__render(struct ax_backend* bac,
                 goto sdl_err;
             }
             SDL_Rect r;
-            r.x = d.t.pos.x;
-            r.y = d.t.pos.y;
+            r.x = AX_LENGTH_TO_DOUBLE(d.t.pos.x);
+            r.y = AX_LENGTH_TO_DOUBLE(d.t.pos.y);
             r.w = sf->w;
             r.h = sf->h;
             SDL_RenderCopy(bac->render, tx, NULL, &r);
@@ -204,11 +220,45 @@ int ax__new_font(struct ax_state* ax,
         goto err;
     }
     char* path = s + 6;
-    void* f = TTF_OpenFont(path, size);
-    if (f == NULL) {
+    TTF_Font* ttf = TTF_OpenFont(path, size);
+    if (ttf == NULL) {
         ax__set_error(ax, TTF_GetError());
         return 1;
     }
+    // layout adds up glyph advances (see ax__font_metrics()), which only matches the
+    // rendered text if there's no kerning. so characters that kern with any other
+    // character in the table are left out of it, and strings with them are measured by
+    // TTF, which kerns them the same way that rendering does.
+    bool kerns[AX_FONT_N_ADVANCES] = { false };
+    if (TTF_GetFontKerning(ttf)) {
+        for (int a = ' '; a <= '~'; a++) {
+            for (int b = ' '; b <= '~'; b++) {
+                if (TTF_GetFontKerningSizeGlyphs(ttf, a, b) != 0) {
+                    kerns[a] = kerns[b] = true;
+                }
+            }
+        }
+    }
+
+    struct ax_font* f = malloc(sizeof(struct ax_font));
+    if (f == NULL) {
+        TTF_CloseFont(ttf);
+        ax__set_error(ax, "out of memory for font");
+        return 1;
+    }
+    f->ttf = ttf;
+    f->metrics.text_height = AX_LENGTH(TTF_FontHeight(ttf));
+    f->metrics.line_spacing = AX_LENGTH(TTF_FontLineSkip(ttf));
+    for (int ch = 0; ch < AX_FONT_N_ADVANCES; ch++) {
+        int adv;
+        if (ch >= ' ' && ch <= '~' && !kerns[ch] &&
+            TTF_GlyphIsProvided(ttf, ch) &&
+            TTF_GlyphMetrics(ttf, ch, NULL, NULL, NULL, NULL, &adv) == 0) {
+            f->metrics.advances[ch] = AX_LENGTH(adv);
+        } else {
+            f->metrics.advances[ch] = AX_LENGTH(-1.0);
+        }
+    }
     *out_font = f;
     return 0;
 err:
@@ -218,23 +268,69 @@ err:
 
 void ax__destroy_font(struct ax_font* font)
 {
-    TTF_CloseFont((void*) font);
+    TTF_CloseFont(font->ttf);
+    free(font);
+}
+
+const struct ax_font_metrics* ax__font_metrics(struct ax_font* font)
+{
+    return &font->metrics;
 }
 
 void ax__measure_text(
     struct ax_font* font_,
     const char* text,
+    size_t len,
     struct ax_text_metrics* tm)
 {
-    TTF_Font* font = (void*) font_;
+    TTF_Font* font = font_->ttf;
     int w_int;
-    if (text == NULL) {
+    if (text == NULL || len == 0) {
         w_int = 0;
     } else {
-        int rv = TTF_SizeUTF8(font, text, &w_int, NULL);
+        // TTF only measures null terminated strings
+        char small_buf[256];
+        char* buf = len < sizeof(small_buf) ? small_buf : malloc(len + 1);
+        ASSERT(buf != NULL, "malloc text to measure");
+        memcpy(buf, text, len);
+        buf[len] = '\0';
+        int rv = TTF_SizeUTF8(font, buf, &w_int, NULL);
+        if (buf != small_buf) {
+            free(buf);
+        }
         ASSERT(rv == 0, "TTF_SizeText failed");
     }
-    tm->text_height = TTF_FontHeight(font);
-    tm->line_spacing = TTF_FontLineSkip(font);
-    tm->width = w_int;
+    tm->text_height = AX_LENGTH(TTF_FontHeight(font));
+    tm->line_spacing = AX_LENGTH(TTF_FontLineSkip(font));
+    tm->width = AX_LENGTH(w_int);
+}
+
+void ax__measure_text_batch(
+    struct ax_font* font,
+    const char* text,
+    const struct ax_text_span* spans,
+    size_t n,
+    ax_length* out_widths)
+{
+    size_t max_len = 0;
+    for (size_t i = 0; i < n; i++) {
+        max_len = spans[i].len > max_len ? spans[i].len : max_len;
+    }
+    // one scratch buffer for the whole batch, since TTF wants null terminated strings
+    char small_buf[256];
+    char* buf = max_len < sizeof(small_buf) ? small_buf : malloc(max_len + 1);
+    ASSERT(buf != NULL, "malloc text to measure");
+    for (size_t i = 0; i < n; i++) {
+        int w_int = 0;
+        if (spans[i].len > 0) {
+            memcpy(buf, text + spans[i].offset, spans[i].len);
+            buf[spans[i].len] = '\0';
+            int rv = TTF_SizeUTF8(font->ttf, buf, &w_int, NULL);
+            ASSERT(rv == 0, "TTF_SizeText failed");
+        }
+        out_widths[i] = AX_LENGTH(w_int);
+    }
+    if (buf != small_buf) {
+        free(buf);
+    }
 }
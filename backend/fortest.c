@@ -10,6 +10,7 @@
 
 struct ax_font {
     ax_length size;
+    struct ax_font_metrics metrics;
 };
 
 int ax__new_backend(struct ax_state* s, struct ax_backend** out_bac)
@@ -19,9 +20,9 @@ int ax__new_backend(struct ax_state* s, struct ax_backend** out_bac)
     bac->ds_len = 0;
     pthread_mutex_init(&bac->sig_mx, NULL);
     bac->sig.close = false;
+    bac->hold = bac->held = false;
     pthread_cond_init(&bac->sync, NULL);
     pthread_mutex_init(&bac->sync_mx, NULL);
-    ax__init_region(&bac->font_rgn);
     *out_bac = bac;
     return 0;
 }
@@ -29,7 +30,6 @@ int ax__new_backend(struct ax_state* s, struct ax_backend** out_bac)
 void ax__destroy_backend(struct ax_backend* bac)
 {
     if (bac != NULL) {
-        ax__free_region(&bac->font_rgn);
         pthread_mutex_destroy(&bac->sync_mx);
         pthread_cond_destroy(&bac->sync);
         pthread_mutex_destroy(&bac->sig_mx);
@@ -78,6 +78,32 @@ void ax__render(struct ax_backend* bac,
     bac->ds = draws;
     bac->ds_len = len;
     pthread_cond_broadcast(&bac->sync);
+    if (bac->hold) {
+        bac->held = true;
+        pthread_cond_broadcast(&bac->sync);
+        while (bac->hold) {
+            pthread_cond_wait(&bac->sync, &bac->sync_mx);
+        }
+        bac->held = false;
+    }
+    pthread_mutex_unlock(&bac->sync_mx);
+}
+
+void ax_test_backend_hold_frame(struct ax_backend* bac)
+{
+    pthread_mutex_lock(&bac->sync_mx);
+    bac->hold = true;
+    while (!bac->held) {
+        pthread_cond_wait(&bac->sync, &bac->sync_mx);
+    }
+    pthread_mutex_unlock(&bac->sync_mx);
+}
+
+void ax_test_backend_release_frame(struct ax_backend* bac)
+{
+    pthread_mutex_lock(&bac->sync_mx);
+    bac->hold = false;
+    pthread_cond_broadcast(&bac->sync);
     pthread_mutex_unlock(&bac->sync_mx);
 }
 
@@ -109,19 +135,51 @@ int ax__new_font(struct ax_state* s, struct ax_backend* bac,
         ax__set_error(s, "invalid fake font");
         return 1;
     }
-    struct ax_font* font = ALLOCATE(&bac->font_rgn, struct ax_font);
-    font->size = strtol(desc + 5, NULL, 10);
+    // NOTE: fonts may outlive the backend that created them (see geom/font.h)
+    (void) bac;
+    struct ax_font* font = malloc(sizeof(struct ax_font));
+    if (font == NULL) {
+        ax__set_error(s, "out of memory for font");
+        return 1;
+    }
+    font->size = AX_LENGTH(strtol(desc + 5, NULL, 10));
+    font->metrics.text_height = font->size;
+    font->metrics.line_spacing = font->size;
+    for (size_t i = 0; i < AX_FONT_N_ADVANCES; i++) {
+        // (monospace)
+        font->metrics.advances[i] = font->size;
+    }
     *out_font = font;
     return 0;
 }
 
-void ax__destroy_font(struct ax_font* font) { (void) font; }
+void ax__destroy_font(struct ax_font* font) { free(font); }
+
+const struct ax_font_metrics* ax__font_metrics(struct ax_font* font)
+{
+    return &font->metrics;
+}
 
 void ax__measure_text(
     struct ax_font* font,
     const char* text,
+    size_t len,
     struct ax_text_metrics* tm)
 {
+    (void) text;
     tm->line_spacing = tm->text_height = font->size;
-    tm->width = strlen(text) * font->size;
+    tm->width = (ax_length) len * font->size;
+}
+
+void ax__measure_text_batch(
+    struct ax_font* font,
+    const char* text,
+    const struct ax_text_span* spans,
+    size_t n,
+    ax_length* out_widths)
+{
+    (void) text;
+    for (size_t i = 0; i < n; i++) {
+        out_widths[i] = (ax_length) spans[i].len * font->size;
+    }
 }
@@ -15,8 +15,14 @@ struct ax_backend {
     pthread_cond_t sync;
     pthread_mutex_t sync_mx;
 
-    struct region font_rgn;
+    // (see ax_test_backend_hold_frame())
+    bool hold, held;
 };
 
 void ax_test_backend_sync_until(struct ax_backend* bac, size_t desired_len);
 void ax_test_backend_sig_close(struct ax_backend* bac);
+
+// stops the ui thread in its next ax__render(), so that it keeps displaying that frame
+// until ax_test_backend_release_frame(). returns once it has stopped.
+void ax_test_backend_hold_frame(struct ax_backend* bac);
+void ax_test_backend_release_frame(struct ax_backend* bac);
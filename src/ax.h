@@ -1,6 +1,7 @@
 #pragma once
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /*
  * Setup and teardown
@@ -22,9 +23,32 @@ int ax_poll_event_fd(struct ax_state* s);
 // returns 'true' if one of the 'read' functions below would not block.
 bool ax_poll_event(struct ax_state* s);
 
-// blocks until the window is closed. currently 'close' is the only kind of event. in the
-// future there needs to be a mechanism to read one event, then dispatch on what kind it
-// is.
+enum ax_event_type {
+    // the window was closed
+    AX_EVENT_CLOSE = 0,
+
+    // a list node needs the rows of its items [first, first + count), since they are
+    // in the window (or near it) and aren't among its children. they are given by
+    // setting a tree where the list with this key has those rows as its children, and
+    // 'first' as its first item. ('id' is the list's id in the current tree, as used
+    // by 'patch'.)
+    AX_EVENT_ROWS,
+};
+
+struct ax_event {
+    enum ax_event_type ty;
+    struct {
+        size_t id;
+        int64_t key;
+        size_t first, count;
+    } rows;
+};
+
+// blocks until there is an event, and reads it into 'out'. returns 'false' if there
+// won't be any more events.
+bool ax_read_event(struct ax_state* s, struct ax_event* out);
+
+// blocks until the window is closed. other events before that are dropped.
 void ax_read_close_event(struct ax_state* s);
 
 /*
@@ -7,6 +7,7 @@ struct ax_font;
 struct ax_state;
 struct ax_draw;
 struct ax_text_metrics;
+struct ax_text_span;
 
 /*
  * Backend events
@@ -51,7 +52,34 @@ int ax__new_font(struct ax_state* s, // used for ax__set_error()
 
 void ax__destroy_font(struct ax_font* font);
 
+// measures the width of each of the 'n' spans of 'text' at once, so that backends can
+// amortize the per-call overhead.
+void ax__measure_text_batch(
+    struct ax_font* font,
+    const char* text,
+    const struct ax_text_span* spans,
+    size_t n,
+    ax_length* out_widths);
+
+// code points below this have precomputed advances in 'struct ax_font_metrics'
+#define AX_FONT_N_ADVANCES 128
+
+struct ax_font_metrics {
+    ax_length text_height;
+    ax_length line_spacing;
+    // advance of each code point, or negative if the backend has to measure strings
+    // containing it (e.g. it kerns with other characters, needs shaping, or isn't a
+    // printable character).
+    ax_length advances[AX_FONT_N_ADVANCES];
+};
+
+// computed when the font is created; the returned pointer is valid for as long as the
+// font is.
+const struct ax_font_metrics* ax__font_metrics(struct ax_font* font);
+
+// 'text' does not need to be null terminated
 void ax__measure_text(
     struct ax_font* font,
     const char* text,
+    size_t len,
     struct ax_text_metrics* out_metrics);
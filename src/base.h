@@ -4,7 +4,48 @@
 #include <stdbool.h>
 
 typedef uint32_t ax_color;
+
+// lengths are doubles, unless the build defines AX_LENGTH_FLOAT (floats) or
+// AX_LENGTH_FIXED (26.6 fixed point, i.e. 1/64ths of a pixel). lengths coming from
+// outside (parsed sizes, font metrics) are converted with AX_LENGTH(), and go back out
+// with AX_LENGTH_TO_DOUBLE().
+#if defined(AX_LENGTH_FIXED)
+typedef int32_t ax_length;
+#define AX_LENGTH_FRAC_BITS 6
+#define AX_LENGTH_MAX INT32_MAX
+#define AX_LENGTH(_x) ax__length_from_double(_x)
+#define AX_LENGTH_TO_DOUBLE(_l) ((double) (_l) / (1 << AX_LENGTH_FRAC_BITS))
+// '_a * _b / _c' where '_b / _c' is a ratio, without overflowing the product
+#define AX_LENGTH_MUL_DIV(_a, _b, _c) ((ax_length) ((int64_t) (_a) * (_b) / (_c)))
+// '_a + _b' and '_a * _b', which saturate instead of overflowing (like floating point
+// lengths go to infinity)
+#define AX_LENGTH_ADD(_a, _b) ax__length_saturate((int64_t) (_a) + (_b))
+#define AX_LENGTH_MUL(_a, _b) ax__length_saturate((int64_t) (_a) * (_b))
+
+static inline ax_length ax__length_from_double(double x)
+{
+    x *= 1 << AX_LENGTH_FRAC_BITS;
+    return (ax_length) (x < 0 ? x - 0.5 : x + 0.5);
+}
+
+static inline ax_length ax__length_saturate(int64_t x)
+{
+    return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : (ax_length) x;
+}
+#else
+#include <math.h>
+#if defined(AX_LENGTH_FLOAT)
+typedef float ax_length;
+#else
 typedef double ax_length;
+#endif
+#define AX_LENGTH_MAX ((ax_length) INFINITY)
+#define AX_LENGTH(_x) ((ax_length) (_x))
+#define AX_LENGTH_TO_DOUBLE(_l) ((double) (_l))
+#define AX_LENGTH_MUL_DIV(_a, _b, _c) ((_a) * (_b) / (_c))
+#define AX_LENGTH_ADD(_a, _b) ((_a) + (_b))
+#define AX_LENGTH_MUL(_a, _b) ((_a) * (_b))
+#endif
 
 struct ax_pos { ax_length x, y; };
 struct ax_dim { ax_length w, h; };
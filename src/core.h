@@ -6,9 +6,9 @@
 struct ax_lexer;
 struct ax_interp;
 struct ax_tree;
+struct ax_patch;
 struct ax_geom;
 struct ax_drawbuf;
-struct ax_desc;
 struct ax_async;
 
 struct ax_backend_config {
@@ -44,6 +44,12 @@ void ax__set_dim(struct ax_state* s, struct ax_dim dim);
 
 void ax__set_tree(struct ax_state* s, struct ax_tree* new_tree);
 
+// 'text' only needs to stay valid until this returns.
+void ax__append_text(struct ax_state* s, size_t id, const char* text);
+
+// the patch (and its text) only needs to stay valid until this returns.
+void ax__patch(struct ax_state* s, const struct ax_patch* patch);
+
 static inline
 void ax__config_win_size(struct ax_state* s, struct ax_dim d)
 {
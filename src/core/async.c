@@ -64,18 +64,24 @@ void ax__init_async(struct ax_async* async,
     async->layout.geom = geom_subsys;
     async->layout.tree = tree_subsys;
     ax__init_draw_buf(&async->layout.draw_buf);
+    ax__init_growable(&async->layout.dead_text, sizeof(struct ax_text_buf) * 4);
     async->layout.msg = 0;
     pthread_mutex_init(&async->layout.msg_mx, NULL);
     pthread_mutex_init(&async->layout.in_tree_drained_mx, NULL);
+    pthread_mutex_init(&async->layout.in_append_done_mx, NULL);
+    pthread_mutex_init(&async->layout.in_patch_done_mx, NULL);
     pthread_mutex_init(&async->layout.on_layout_mx, NULL);
     pthread_cond_init(&async->layout.new_msg_cv, NULL);
     pthread_cond_init(&async->layout.in_tree_drained, NULL);
+    pthread_cond_init(&async->layout.in_append_done, NULL);
+    pthread_cond_init(&async->layout.in_patch_done, NULL);
     pthread_cond_init(&async->layout.on_layout, NULL);
     pthread_create(&async->layout.thd, NULL, layout_thd, (void*) async);
 
     // ui
     ax__init_draw_buf(&async->ui.disp_draw_buf);
     ax__init_draw_buf(&async->ui.in_draw_buf);
+    ax__init_growable(&async->ui.in_dead_text, sizeof(struct ax_text_buf) * 4);
     async->ui.msg = 0;
     pthread_mutex_init(&async->ui.msg_mx, NULL);
     pthread_mutex_init(&async->ui.on_close_mx, NULL);
@@ -86,7 +92,7 @@ void ax__init_async(struct ax_async* async,
     // evt
     async->evt.write_fd = evt_write_fd;
     async->evt.msg = 0;
-    async->evt.pending_close_evt = false;
+    ax__init_growable(&async->evt.pending_evts, sizeof(struct ax_event) * 16);
     pthread_mutex_init(&async->evt.msg_mx, NULL);
     pthread_cond_init(&async->evt.new_msg_cv, NULL);
     pthread_create(&async->evt.thd, NULL, evt_thd, (void*) async);
@@ -103,27 +109,37 @@ void ax__free_async(struct ax_async* async)
     JOIN(async->evt);
 
     pthread_cond_destroy(&async->layout.on_layout);
+    pthread_cond_destroy(&async->layout.in_patch_done);
+    pthread_cond_destroy(&async->layout.in_append_done);
     pthread_cond_destroy(&async->layout.in_tree_drained);
     pthread_cond_destroy(&async->layout.new_msg_cv);
     pthread_mutex_destroy(&async->layout.on_layout_mx);
+    pthread_mutex_destroy(&async->layout.in_patch_done_mx);
+    pthread_mutex_destroy(&async->layout.in_append_done_mx);
     pthread_mutex_destroy(&async->layout.in_tree_drained_mx);
     pthread_mutex_destroy(&async->layout.msg_mx);
     ax__free_draw_buf(&async->layout.draw_buf);
+    ax__release_text_bufs(&async->layout.dead_text);
+    ax__free_growable(&async->layout.dead_text);
 
     pthread_cond_destroy(&async->ui.on_close);
     pthread_cond_destroy(&async->ui.new_msg_cv);
     pthread_mutex_destroy(&async->ui.on_close_mx);
     pthread_mutex_destroy(&async->ui.msg_mx);
     ax__free_draw_buf(&async->ui.in_draw_buf);
+    ax__release_text_bufs(&async->ui.in_dead_text);
+    ax__free_growable(&async->ui.in_dead_text);
     ax__free_draw_buf(&async->ui.disp_draw_buf);
 
     pthread_cond_destroy(&async->evt.new_msg_cv);
     pthread_mutex_destroy(&async->evt.msg_mx);
+    ax__free_growable(&async->evt.pending_evts);
 }
 
 static void layout_thd_handle(struct ax_async* async, int msg,
                               bool* out_quit, bool* out_needs_layout,
-                              bool* out_notify_about_layout)
+                              bool* out_notify_about_layout,
+                              struct ax_tree** out_new_tree)
 {
     if (msg & ASYNC_QUIT) {
         *out_quit = true;
@@ -133,9 +149,22 @@ static void layout_thd_handle(struct ax_async* async, int msg,
         async->layout.geom->root_dim = async->layout.in_dim;
     }
     if (msg & ASYNC_SET_TREE) {
+        // (reconciling segments text, so it's done after the message lock is released;
+        // the sender waits for 'in_tree_drained' until then)
         *out_needs_layout = true;
-        ax__tree_drain_from(async->layout.tree, async->layout.in_tree);
-        NOTIFY(async->layout.in_tree_drained);
+        *out_new_tree = async->layout.in_tree;
+    }
+    if (msg & ASYNC_APPEND_TEXT) {
+        *out_needs_layout = true;
+        ax__text_append(async->layout.tree,
+                        async->layout.in_append_id,
+                        async->layout.in_append_text);
+        NOTIFY(async->layout.in_append_done);
+    }
+    if (msg & ASYNC_PATCH) {
+        *out_needs_layout = true;
+        ax__tree_patch(async->layout.tree, async->layout.in_patch);
+        NOTIFY(async->layout.in_patch_done);
     }
     if (msg & ASYNC_WAIT_FOR_LAYOUT) {
         *out_notify_about_layout = true;
@@ -148,16 +177,36 @@ static void* layout_thd(void* ud)
     for (bool quit = false; !quit; ) {
         bool needs_layout = false;
         bool notify_about_layout = false;
+        struct ax_tree* new_tree = NULL;
         int msg;
         RECV(async->layout, msg, true,
-             layout_thd_handle(async, msg, &quit, &needs_layout, &notify_about_layout));
+             layout_thd_handle(async, msg, &quit, &needs_layout, &notify_about_layout,
+                               &new_tree));
+
+        if (new_tree != NULL) {
+            ax__tree_reconcile(new_tree, async->layout.tree);
+            // (the displayed draw buffer may still point into the old tree's text)
+            ax__tree_take_text_bufs(async->layout.tree, &async->layout.dead_text);
+            ax__tree_drain_from(async->layout.tree, new_tree);
+            NOTIFY(async->layout.in_tree_drained);
+        }
 
         if (needs_layout) {
             ax__layout(async->layout.tree, async->layout.geom);
+            if (!ax__is_growable_empty(&async->layout.geom->row_requests)) {
+                ax__async_push_evts(async, &async->layout.geom->row_requests);
+            }
             ax__redraw(async->layout.tree, &async->layout.draw_buf);
-            SEND(async->ui, ASYNC_FLIP_BUFFERS,
-                 ax__swap_draw_bufs(&async->ui.in_draw_buf,
-                                    &async->layout.draw_buf));
+            // (text replaced by patches is no longer in the new draw buffer)
+            ax__tree_take_dead_text(async->layout.tree, &async->layout.dead_text);
+            SEND(async->ui, ASYNC_FLIP_BUFFERS, {
+                    ax__swap_draw_bufs(&async->ui.in_draw_buf,
+                                       &async->layout.draw_buf);
+                    ax__growable_extend_with(&async->ui.in_dead_text,
+                                             async->layout.dead_text.size,
+                                             async->layout.dead_text.data);
+                });
+            ax__growable_clear(&async->layout.dead_text);
         }
 
         if (notify_about_layout) {
@@ -178,6 +227,9 @@ static void ui_thd_handle(struct ax_async* async, int msg,
     }
     if (msg & ASYNC_FLIP_BUFFERS) {
         ax__swap_draw_bufs(&async->ui.disp_draw_buf, &async->ui.in_draw_buf);
+        // (the buffer that was displayed until now is the last one that may have pointed
+        // into these)
+        ax__release_text_bufs(&async->ui.in_dead_text);
     }
 }
 
@@ -225,22 +277,28 @@ static void* ui_thd(void* ud)
 static void* evt_thd(void* ud)
 {
     struct ax_async* async = ud;
+    struct growable evts;
+    ax__init_growable(&evts, sizeof(struct ax_event) * 16);
     bool quit = false;
     while (!quit) {
-        bool close_evt;
         int msg;
         RECV(async->evt, msg, true, {
                 if (msg & ASYNC_QUIT) {
                     quit = true;
                 }
-                close_evt = async->evt.pending_close_evt;
-                async->evt.pending_close_evt = false;
+                struct growable tmp = evts;
+                evts = async->evt.pending_evts;
+                async->evt.pending_evts = tmp;
+                ax__growable_clear(&async->evt.pending_evts);
             });
 
-        if (close_evt) {
-            write(async->evt.write_fd, "C", 1);
+        // (see ax_read_event())
+        const struct ax_event* e = evts.data;
+        for (size_t i = 0; i < LEN(&evts, struct ax_event); i++) {
+            write(async->evt.write_fd, &e[i], sizeof(struct ax_event));
         }
     }
+    ax__free_growable(&evts);
     return &async->evt;
 }
 
@@ -259,6 +317,25 @@ void ax__async_set_tree(struct ax_async* async, struct ax_tree* new_tree)
               async->layout.in_tree = new_tree);
 }
 
+void ax__async_append_text(struct ax_async* async, size_t id, const char* text)
+{
+    SEND_SYNC(async->layout,
+              async->layout.in_append_done,
+              ASYNC_APPEND_TEXT,
+              {
+                  async->layout.in_append_id = id;
+                  async->layout.in_append_text = text;
+              });
+}
+
+void ax__async_patch(struct ax_async* async, const struct ax_patch* patch)
+{
+    SEND_SYNC(async->layout,
+              async->layout.in_patch_done,
+              ASYNC_PATCH,
+              async->layout.in_patch = patch);
+}
+
 void ax__async_set_backend(struct ax_async* async, struct ax_backend* bac)
 {
     SEND(async->ui,
@@ -275,8 +352,16 @@ void ax__async_wait_for_layout(struct ax_async* async)
 }
 
 void ax__async_push_close_evt(struct ax_async* async)
+{
+    struct ax_event e = { .ty = AX_EVENT_CLOSE };
+    SEND(async->evt,
+         ASYNC_WAKE_UP,
+         PUSH(&async->evt.pending_evts, &e));
+}
+
+void ax__async_push_evts(struct ax_async* async, const struct growable* evts)
 {
     SEND(async->evt,
          ASYNC_WAKE_UP,
-         async->evt.pending_close_evt = true);
+         ax__growable_extend_with(&async->evt.pending_evts, evts->size, evts->data));
 }
@@ -2,10 +2,12 @@
 #include <pthread.h>
 #include "../backend.h"
 #include "../draw.h"
+#include "growable.h"
 
 struct ax_state;
 struct ax_geom;
 struct ax_tree;
+struct ax_patch;
 
 enum {
     // (all subsystems)
@@ -14,6 +16,8 @@ enum {
     ASYNC_SET_DIM         = 1 << 2,
     ASYNC_SET_TREE        = 1 << 3,
     ASYNC_WAIT_FOR_LAYOUT = 1 << 6,
+    ASYNC_APPEND_TEXT     = 1 << 8,
+    ASYNC_PATCH           = 1 << 9,
     // ui
     ASYNC_SET_BACKEND     = 1 << 4,
     ASYNC_FLIP_BUFFERS    = 1 << 5,
@@ -39,8 +43,21 @@ struct ax_async {
         pthread_cond_t in_tree_drained;
         pthread_mutex_t in_tree_drained_mx;
 
+        size_t in_append_id;
+        const char* in_append_text;
+        pthread_cond_t in_append_done;
+        pthread_mutex_t in_append_done_mx;
+
+        const struct ax_patch* in_patch;
+        pthread_cond_t in_patch_done;
+        pthread_mutex_t in_patch_done_mx;
+
         pthread_cond_t on_layout;
         pthread_mutex_t on_layout_mx;
+
+        // mapped or patched text that trees no longer use, which is handed to the ui
+        // thread along with the next draw buffer (of struct ax_text_buf)
+        struct growable dead_text;
     } layout;
 
     struct {
@@ -50,6 +67,9 @@ struct ax_async {
 
         struct ax_backend* in_backend;
         struct ax_draw_buf in_draw_buf;
+        // (of struct ax_text_buf; nothing in 'in_draw_buf' points into these, so they're
+        // released once it's flipped to)
+        struct growable in_dead_text;
 
         pthread_cond_t on_close;
         pthread_mutex_t on_close_mx;
@@ -60,7 +80,7 @@ struct ax_async {
         int write_fd;
         MESSAGE_QUEUE_VARS();
 
-        bool pending_close_evt;
+        struct growable pending_evts; // (of struct ax_event)
     } evt;
 };
 
@@ -72,8 +92,11 @@ void ax__free_async(struct ax_async* async);
 
 void ax__async_set_dim(struct ax_async* async, struct ax_dim dim);
 void ax__async_set_tree(struct ax_async* async, struct ax_tree* new_tree);
+void ax__async_append_text(struct ax_async* async, size_t id, const char* text);
+void ax__async_patch(struct ax_async* async, const struct ax_patch* patch);
 void ax__async_set_backend(struct ax_async* async, struct ax_backend* bac);
 
 void ax__async_wait_for_layout(struct ax_async* async);
 
 void ax__async_push_close_evt(struct ax_async* async);
+void ax__async_push_evts(struct ax_async* async, const struct growable* evts);
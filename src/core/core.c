@@ -7,11 +7,11 @@
 #include "../ax.h"
 #include "../core.h"
 #include "../tree.h"
-#include "../tree/desc.h"
 #include "../sexp/interp.h"
 #include "../geom.h"
 #include "../draw.h"
 #include "../backend.h"
+#include "../geom/font.h"
 #include "async.h"
 
 struct ax_state* ax_new_state()
@@ -22,7 +22,7 @@ struct ax_state* ax_new_state()
     struct ax_state* s = ALLOCATE(&rgn, struct ax_state);
 
     s->config = (struct ax_backend_config) {
-        .win_size = AX_DIM(800, 600)
+        .win_size = AX_DIM(AX_LENGTH(800), AX_LENGTH(600))
     };
 
     ax__init_region(&s->err_msg_rgn);
@@ -62,6 +62,9 @@ void ax_destroy_state(struct ax_state* s)
         ax__free_tree(s->tree);
         ax__free_interp(s->interp);
         ax__free_lexer(s->lexer);
+        // fonts are shared between states, so only the ones nobody uses anymore can be
+        // destroyed along with this backend
+        ax__purge_fonts();
         ax__destroy_backend(s->backend);
         ax__free_region(&s->err_msg_rgn);
 
@@ -102,15 +105,31 @@ bool ax_poll_event(struct ax_state* s)
     return select(fd + 1, &rd_fds, NULL, NULL, &tmout) > 0;
 }
 
+bool ax_read_event(struct ax_state* s, struct ax_event* out)
+{
+    // (events are written to the pipe whole, one 'struct ax_event' at a time)
+    size_t len = 0;
+    while (len < sizeof(struct ax_event)) {
+        ssize_t n = read(ax_poll_event_fd(s), (char*) out + len,
+                         sizeof(struct ax_event) - len);
+        if (n <= 0) {
+            return false;
+        }
+        len += n;
+    }
+    return true;
+}
+
 void ax_read_close_event(struct ax_state* s)
 {
     ASSERT(s->backend != NULL, "backend must be initialized!");
 
-    char buf[2] = {'\0', '\0'};
-    size_t n = read(ax_poll_event_fd(s), buf, 1);
-    if (n > 0) {
-        ASSERT(strcmp(buf, "C") == 0, "got \"%s\"", buf);
-    }
+    struct ax_event e;
+    do {
+        if (!ax_read_event(s, &e)) {
+            return;
+        }
+    } while (e.ty != AX_EVENT_CLOSE);
 }
 
 const char* ax_get_error(struct ax_state* s)
@@ -183,3 +202,13 @@ void ax__set_tree(struct ax_state* s, struct ax_tree* new_tree)
     ax__async_set_tree(s->async, new_tree);
     ASSERT(ax__is_tree_empty(new_tree), "tree should be empty after setting");
 }
+
+void ax__append_text(struct ax_state* s, size_t id, const char* text)
+{
+    ax__async_append_text(s->async, id, text);
+}
+
+void ax__patch(struct ax_state* s, const struct ax_patch* patch)
+{
+    ax__async_patch(s->async, patch);
+}
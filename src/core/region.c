@@ -116,6 +116,14 @@ void* ax__strdup(struct region* rgn, const char* str)
     return new;
 }
 
+void* ax__strndup(struct region* rgn, const char* str, size_t len)
+{
+    char* new = ALLOCATES(rgn, char, len + 1);
+    memcpy(new, str, len);
+    new[len] = '\0';
+    return new;
+}
+
 void* ax__strcat(struct region* rgn, const char* s1, const char* s2)
 {
     size_t len1 = strlen(s1);
@@ -46,6 +46,7 @@ void ax__swap_regions(struct region* fst, struct region* snd)
 }
 
 void* ax__strdup(struct region* rgn, const char* str);
+void* ax__strndup(struct region* rgn, const char* str, size_t len);
 void* ax__strcat(struct region* rgn, const char* s1, const char* s2);
 
 #define ALLOCATE(_rgn, T) ((T *) ax__region_alloc(_rgn, sizeof(T)))
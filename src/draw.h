@@ -23,7 +23,9 @@ struct ax_draw_r {
 struct ax_draw_t {
     ax_color color;
     struct ax_font* font;
+    // points into the text node; NOT null terminated
     const char* text;
+    size_t len;
     struct ax_pos pos;
 };
 
@@ -37,6 +39,8 @@ struct ax_draw {
 
 struct ax_draw_buf {
     struct growable growable;
+    // the explicit stack for ax__redraw(), kept so that it isn't allocated on every redraw
+    struct growable stack;
 };
 
 void ax__init_draw_buf(struct ax_draw_buf* db);
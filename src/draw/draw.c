@@ -1,16 +1,24 @@
 #include <string.h>
-#define AX_DEFINE_TRAVERSAL_MACROS
 #include "../tree.h"
 #include "../draw.h"
+#include "../geom.h"
+#include "../backend.h"
 #include "../utils.h"
 
+// the ranges of siblings that ax__redraw() has left to paint at each level
+struct sibling_range {
+    node_id next, end;
+};
+
 void ax__init_draw_buf(struct ax_draw_buf* db)
 {
     ax__init_growable(&db->growable, DEFAULT_CAPACITY);
+    ax__init_growable(&db->stack, sizeof(struct sibling_range) * 16);
 }
 
 void ax__free_draw_buf(struct ax_draw_buf* db)
 {
+    ax__free_growable(&db->stack);
     ax__free_growable(&db->growable);
 }
 
@@ -19,41 +27,67 @@ static struct ax_draw* draw_buf_ins(struct ax_draw_buf* db)
     return ax__growable_extend(&db->growable, sizeof(struct ax_draw));
 }
 
-static void redraw_(struct ax_node* node, struct ax_draw_buf* db)
+static void redraw_(struct ax_tree* tr, struct ax_node* node, struct ax_draw_buf* db)
 {
+    // (the window, since the root is laid out to its size)
+    struct ax_dim win = tr->target[0];
+    struct ax_aabb bounds = {
+        .o = tr->coord[ax__node_id(tr, node)],
+        .s = tr->target[ax__node_id(tr, node)],
+    };
     switch (node->ty) {
     case AX_NODE_CONTAINER:
-        if (!AX_COLOR_IS_NULL(node->c.background)) {
+        if (!AX_COLOR_IS_NULL(node->c.background) && ax__in_window(bounds, win)) {
             struct ax_draw* d = draw_buf_ins(db);
             d->ty = AX_DRAW_RECT;
             d->r.fill = node->c.background;
-            d->r.bounds.o = node->coord;
-            d->r.bounds.s = node->target;
+            d->r.bounds = bounds;
         }
         break;
 
     case AX_NODE_RECTANGLE: {
+        bounds.s = node->r.size;
+        if (!ax__in_window(bounds, win)) {
+            break;
+        }
         struct ax_draw* d = draw_buf_ins(db);
         d->ty = AX_DRAW_RECT;
         d->r.fill = node->r.fill;
-        d->r.bounds.o = node->coord;
-        d->r.bounds.s = node->r.size;
+        d->r.bounds = bounds;
         break;
     }
 
-    case AX_NODE_TEXT:
-        for (struct ax_node_t_line* line = node->t.lines;
-             line != NULL;
-             line = line->next)
-        {
+    case AX_NODE_TEXT: {
+        if (node->t.culled) {
+            break;
+        }
+        const struct ax_font_metrics* fm = ax__font_metrics(node->t.font);
+        for (size_t i = 0; i < node->t.n_lines; i++) {
+            const struct ax_node_t_line* line = &node->t.lines[i];
+            struct ax_aabb line_bounds = {
+                .o = line->coord, .s = AX_DIM(line->width, fm->text_height),
+            };
+            if (line->coord.y >= win.h) {
+                // (the rest of the lines are further down)
+                break;
+            }
+            if (!ax__in_window(line_bounds, win)) {
+                continue;
+            }
             struct ax_draw* d = draw_buf_ins(db);
             d->ty = AX_DRAW_TEXT;
             d->t.color = node->t.color;
             d->t.font = node->t.font;
-            d->t.text = line->str;
+            d->t.text = node->t.text + line->offset;
+            d->t.len = line->len;
             d->t.pos = line->coord;
         }
         break;
+    }
+
+    case AX_NODE_LIST:
+        // (only its rows are drawn)
+        break;
 
     default: NO_SUCH_NODE_TAG();
     }
@@ -65,9 +99,39 @@ void ax__redraw(struct ax_tree* tr, struct ax_draw_buf* db)
         return;
     }
 
-    DEFINE_TRAVERSAL_LOCALS(tr, node);
+    // nodes are painted in preorder (parents, then each child's whole subtree in turn),
+    // which isn't the order of the ids. the stack holds the ranges of siblings that are
+    // still left to paint at each level.
+    struct growable* stack = &db->stack;
+    ax__growable_clear(stack);
     ax__growable_clear(&db->growable);
-    FOR_EACH_FROM_TOP(node) {
-        redraw_(node, db);
+    // subtrees that don't overlap the window are skipped
+    struct ax_dim win = tr->target[0];
+    if (!ax__in_window(tr->extent[0], win)) {
+        return;
+    }
+    redraw_(tr, ax__root(tr), db);
+    struct sibling_range children = {
+        tr->first_child[0], tr->first_child[0] + tr->n_children[0]
+    };
+    PUSH(stack, &children);
+    while (!ax__is_growable_empty(stack)) {
+        struct sibling_range* top =
+            (struct sibling_range*) stack->data + LEN(stack, struct sibling_range) - 1;
+        if (top->next >= top->end) {
+            ax__growable_retract(stack, sizeof(struct sibling_range));
+            continue;
+        }
+        node_id id = top->next++;
+        if (!ax__in_window(tr->extent[id], win)) {
+            continue;
+        }
+        redraw_(tr, ax__node_by_id(tr, id), db);
+        if (tr->n_children[id] > 0) {
+            children = (struct sibling_range) {
+                tr->first_child[id], tr->first_child[id] + tr->n_children[id]
+            };
+            PUSH(stack, &children);
+        }
     }
 }
@@ -1,16 +1,111 @@
 #pragma once
+#include <pthread.h>
 #include "base.h"
 #include "core/region.h"
+#include "core/growable.h"
 
 struct ax_tree;
 
+// text nodes with at least this many words are wrapped on several of the layout workers at
+// once, split at paragraph breaks into at most AX_PARALLEL_WRAP_MAX_JOBS runs.
+#define AX_PARALLEL_WRAP_MIN_WORDS  16384
+#define AX_PARALLEL_WRAP_MAX_JOBS   16
+
+// trees with at least this many nodes are laid out on up to AX_PARALLEL_LAYOUT_MAX_WORKERS
+// threads, by splitting the dirty part of the tree into subtrees. there are about
+// AX_PARALLEL_LAYOUT_TASKS_PER_WORKER subtrees per thread, which they steal from each
+// other as they run out.
+#define AX_PARALLEL_LAYOUT_MIN_NODES        8192
+#define AX_PARALLEL_LAYOUT_MAX_WORKERS      32
+#define AX_PARALLEL_LAYOUT_TASKS_PER_WORKER 4
+
+// results computed during one layout, by the structural hash of the subtree and a
+// constraint, so that identical subtrees with the same constraint can share them. it's
+// an open-addressed table, which is cleared in O(1) by bumping 'gen' for each layout.
+struct ax_layout_memo_entry {
+    uint64_t hash;
+    struct ax_dim constraint;
+    uint32_t id;
+    uint32_t gen; // (the entry is empty unless this is the table's 'gen')
+};
+
+struct ax_layout_memo {
+    size_t cap, count;
+    uint32_t gen;
+    struct ax_layout_memo_entry* entries;
+};
+
+// state of one thread laying out subtrees. (none of it is shared, so that the threads
+// don't have to synchronize)
+struct ax_layout_worker {
+    struct region temp_rgn;
+    struct growable work; // (of node_id; the dirty nodes of its subtree, see ax__layout())
+    struct ax_layout_memo hypoth_memo; // (containers, by available size)
+    struct ax_layout_memo wrap_memo;   // (text nodes, by wrap width)
+    struct growable row_requests;      // (of struct ax_event)
+    // the workers to wrap large text on, or NULL if they're all busy with tasks
+    struct ax_geom* wrap_pool;
+};
+
+// a range of the tasks, which its worker takes from the back, and other workers steal from
+// the front.
+struct ax_layout_deque {
+    pthread_mutex_t mx;
+    size_t front, back;
+};
+
+struct ax_geom;
+
+// a thread that runs one of the workers for each pass (see 'struct ax_geom')
+struct ax_layout_thread {
+    pthread_t thd;
+    struct ax_geom* g;
+    size_t k;
+    size_t pass; // (the last pass it ran, or the one before it was started)
+};
+
+typedef void (*ax_layout_pass_fn)(struct ax_geom* g, size_t k, void* arg);
+
 struct ax_geom {
     struct ax_dim root_dim;
-    struct region layout_rgn;
-    struct region temp_rgn;
+
+    // workers[0] is the thread that calls ax__layout(). the others each have a thread,
+    // which is started by the first layout that can use it and sleeps until the next
+    // pass: a pass calls 'pass_fn' once for each worker, and ends when they have all
+    // returned. (most states only ever lay out small trees, and never start any.)
+    size_t n_workers;   // (including workers[0])
+    size_t max_workers; // (the number to start once they're needed)
+    bool workers_started;
+    struct ax_layout_worker* workers; // (of n_workers)
+    struct ax_layout_deque* deques;   // (of n_workers)
+    struct ax_layout_thread* threads; // (of n_workers; threads[0] unused)
+    pthread_mutex_t pool_mx;
+    pthread_cond_t pass_cv, done_cv;
+    size_t pass, n_done;
+    bool quit;
+    ax_layout_pass_fn pass_fn;
+    void* pass_arg;
+    struct growable top;   // (of node_id; the part of the tree above the tasks)
+    struct growable tasks; // (of node_id; roots of subtrees)
+
+    // AX_EVENT_ROWS events for the rows that lists need, from the last layout
+    struct growable row_requests; // (of struct ax_event)
 };
 
+// whether 'box' overlaps a window of size 'win'. (a box that ends exactly at the window's
+// top or left edge counts as overlapping.)
+static inline bool ax__in_window(struct ax_aabb box, struct ax_dim win)
+{
+    return box.o.x < win.w && box.o.y < win.h &&
+        box.o.x + box.s.w >= 0 && box.o.y + box.s.h >= 0;
+}
+
 void ax__init_geom(struct ax_geom* g);
 void ax__free_geom(struct ax_geom* g);
 
+// stops the workers' threads, so that the next layout that can use them starts 'n' - 1
+// new ones. (fewer, if threads can't be created.) this must not be called during
+// ax__layout().
+void ax__set_layout_workers(struct ax_geom* g, size_t n);
+
 void ax__layout(struct ax_tree* tr, struct ax_geom* g);
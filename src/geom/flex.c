@@ -0,0 +1,252 @@
+#include <pthread.h>
+#include "flex.h"
+
+// (fixed point lengths need 64-bit products in the targets, so they stay scalar)
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(AX_LENGTH_FIXED)
+#define AX_FLEX_AVX2 1
+#include <immintrin.h>
+#else
+#define AX_FLEX_AVX2 0
+#endif
+
+// (a fused multiply-add would round differently from the AVX2 kernels, which don't use
+// them)
+#pragma GCC optimize("fp-contract=off")
+
+// the lanes of an AVX2 register. partial sums are combined by adding the upper half of
+// the lanes to the lower half, until one is left.
+#define N_LANES (32 / sizeof(ax_length))
+
+// (the same operand order as _mm256_max_pd(), so that it agrees on equal values)
+static inline ax_length max_lane(ax_length a, ax_length b)
+{
+    return a > b ? a : b;
+}
+
+static void line_sums_scalar(const ax_length* main, const ax_length* cross, size_t n,
+                             ax_length* out_main_sum, ax_length* out_cross_max)
+{
+    ax_length sum[N_LANES] = { 0.0 }, max[N_LANES] = { 0.0 };
+    size_t i = 0;
+    for (; i + N_LANES <= n; i += N_LANES) {
+        for (size_t k = 0; k < N_LANES; k++) {
+            sum[k] = AX_LENGTH_ADD(sum[k], main[i + k]);
+            max[k] = max_lane(cross[i + k], max[k]);
+        }
+    }
+    for (size_t w = N_LANES / 2; w > 0; w /= 2) {
+        for (size_t k = 0; k < w; k++) {
+            sum[k] = AX_LENGTH_ADD(sum[k], sum[k + w]);
+            max[k] = max_lane(max[k], max[k + w]);
+        }
+    }
+    ax_length s = sum[0], m = max[0];
+    for (; i < n; i++) {
+        s = AX_LENGTH_ADD(s, main[i]);
+        m = max_lane(cross[i], m);
+    }
+    *out_main_sum = s;
+    *out_cross_max = m;
+}
+
+static ax_length factors_scalar(const ax_length* main,
+                                const ax_length* grow,
+                                const ax_length* shrink,
+                                size_t n,
+                                bool did_overflow,
+                                ax_length* out_factor)
+{
+    ax_length sum[N_LANES] = { 0.0 };
+    size_t i = 0;
+    for (; i + N_LANES <= n; i += N_LANES) {
+        for (size_t k = 0; k < N_LANES; k++) {
+            ax_length f = did_overflow ? AX_LENGTH_MUL(shrink[i + k], main[i + k]) :
+                grow[i + k];
+            out_factor[i + k] = f;
+            sum[k] = AX_LENGTH_ADD(sum[k], f);
+        }
+    }
+    for (size_t w = N_LANES / 2; w > 0; w /= 2) {
+        for (size_t k = 0; k < w; k++) {
+            sum[k] = AX_LENGTH_ADD(sum[k], sum[k + w]);
+        }
+    }
+    ax_length s = sum[0];
+    for (; i < n; i++) {
+        ax_length f = did_overflow ? AX_LENGTH_MUL(shrink[i], main[i]) : grow[i];
+        out_factor[i] = f;
+        s = AX_LENGTH_ADD(s, f);
+    }
+    return s;
+}
+
+static void targets_scalar(const ax_length* main, const ax_length* factor, size_t n,
+                           ax_length free_space, ax_length factor_sum,
+                           ax_length* out_main)
+{
+    for (size_t i = 0; i < n; i++) {
+        ax_length flex = factor[i] > 0 ?
+            AX_LENGTH_MUL_DIV(free_space, factor[i], factor_sum) : 0.0;
+        out_main[i] = AX_LENGTH_ADD(main[i], flex);
+    }
+}
+
+const struct ax_flex_kernels ax__flex_scalar_kernels = {
+    .name = "scalar",
+    .line_sums = line_sums_scalar,
+    .factors = factors_scalar,
+    .targets = targets_scalar,
+};
+
+#if AX_FLEX_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+#if defined(AX_LENGTH_FLOAT)
+typedef __m256 vec;
+#define V_ZERO()        _mm256_setzero_ps()
+#define V_SET1(_x)      _mm256_set1_ps(_x)
+#define V_LOAD(_p)      _mm256_loadu_ps(_p)
+#define V_STORE(_p, _v) _mm256_storeu_ps(_p, _v)
+#define V_ADD(_a, _b)   _mm256_add_ps(_a, _b)
+#define V_MUL(_a, _b)   _mm256_mul_ps(_a, _b)
+#define V_DIV(_a, _b)   _mm256_div_ps(_a, _b)
+#define V_MAX(_a, _b)   _mm256_max_ps(_a, _b)
+#define V_AND(_a, _b)   _mm256_and_ps(_a, _b)
+#define V_GT(_a, _b)    _mm256_cmp_ps(_a, _b, _CMP_GT_OQ)
+
+// ((v0 + v4) + (v2 + v6)) + ((v1 + v5) + (v3 + v7))
+static inline AVX2 float hsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+static inline AVX2 float hmax(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+}
+#else
+typedef __m256d vec;
+#define V_ZERO()        _mm256_setzero_pd()
+#define V_SET1(_x)      _mm256_set1_pd(_x)
+#define V_LOAD(_p)      _mm256_loadu_pd(_p)
+#define V_STORE(_p, _v) _mm256_storeu_pd(_p, _v)
+#define V_ADD(_a, _b)   _mm256_add_pd(_a, _b)
+#define V_MUL(_a, _b)   _mm256_mul_pd(_a, _b)
+#define V_DIV(_a, _b)   _mm256_div_pd(_a, _b)
+#define V_MAX(_a, _b)   _mm256_max_pd(_a, _b)
+#define V_AND(_a, _b)   _mm256_and_pd(_a, _b)
+#define V_GT(_a, _b)    _mm256_cmp_pd(_a, _b, _CMP_GT_OQ)
+
+// (v0 + v2) + (v1 + v3)
+static inline AVX2 double hsum(__m256d v)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+static inline AVX2 double hmax(__m256d v)
+{
+    __m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+}
+#endif
+
+static AVX2 void line_sums_avx2(const ax_length* main, const ax_length* cross, size_t n,
+                                ax_length* out_main_sum, ax_length* out_cross_max)
+{
+    vec sum = V_ZERO(), max = V_ZERO();
+    size_t i = 0;
+    for (; i + N_LANES <= n; i += N_LANES) {
+        sum = V_ADD(sum, V_LOAD(main + i));
+        max = V_MAX(V_LOAD(cross + i), max);
+    }
+    ax_length s = hsum(sum), m = hmax(max);
+    for (; i < n; i++) {
+        s = AX_LENGTH_ADD(s, main[i]);
+        m = max_lane(cross[i], m);
+    }
+    *out_main_sum = s;
+    *out_cross_max = m;
+}
+
+static AVX2 ax_length factors_avx2(const ax_length* main,
+                                   const ax_length* grow,
+                                   const ax_length* shrink,
+                                   size_t n,
+                                   bool did_overflow,
+                                   ax_length* out_factor)
+{
+    vec sum = V_ZERO();
+    size_t i = 0;
+    for (; i + N_LANES <= n; i += N_LANES) {
+        vec f = did_overflow ?
+            V_MUL(V_LOAD(shrink + i), V_LOAD(main + i)) :
+            V_LOAD(grow + i);
+        V_STORE(out_factor + i, f);
+        sum = V_ADD(sum, f);
+    }
+    ax_length s = hsum(sum);
+    for (; i < n; i++) {
+        ax_length f = did_overflow ? AX_LENGTH_MUL(shrink[i], main[i]) : grow[i];
+        out_factor[i] = f;
+        s = AX_LENGTH_ADD(s, f);
+    }
+    return s;
+}
+
+static AVX2 void targets_avx2(const ax_length* main, const ax_length* factor, size_t n,
+                              ax_length free_space, ax_length factor_sum,
+                              ax_length* out_main)
+{
+    vec fs = V_SET1(free_space), sum = V_SET1(factor_sum), zero = V_ZERO();
+    size_t i = 0;
+    for (; i + N_LANES <= n; i += N_LANES) {
+        vec f = V_LOAD(factor + i);
+        // (the lanes with factor <= 0 may divide by zero, but they are masked off)
+        vec flex = V_AND(V_DIV(V_MUL(fs, f), sum), V_GT(f, zero));
+        V_STORE(out_main + i, V_ADD(V_LOAD(main + i), flex));
+    }
+    targets_scalar(main + i, factor + i, n - i, free_space, factor_sum, out_main + i);
+}
+
+static const struct ax_flex_kernels flex_avx2_kernels = {
+    .name = "avx2",
+    .line_sums = line_sums_avx2,
+    .factors = factors_avx2,
+    .targets = targets_avx2,
+};
+
+#endif
+
+const struct ax_flex_kernels* ax__flex_avx2_kernels(void)
+{
+#if AX_FLEX_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &flex_avx2_kernels;
+    }
+#endif
+    return NULL;
+}
+
+static pthread_once_t chosen_once = PTHREAD_ONCE_INIT;
+static const struct ax_flex_kernels* chosen;
+
+static void choose_kernels(void)
+{
+    chosen = ax__flex_avx2_kernels();
+    if (chosen == NULL) {
+        chosen = &ax__flex_scalar_kernels;
+    }
+}
+
+const struct ax_flex_kernels* ax__flex_kernels(void)
+{
+    pthread_once(&chosen_once, choose_kernels);
+    return chosen;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+#include "../base.h"
+
+/*
+ * Kernels for resolving the sizes of a line of flex items, over dense arrays of the
+ * items' sizes and factors rather than over the tree. There is a scalar version, and an
+ * AVX2 version that is picked at runtime on CPUs that support it.
+ *
+ * Both versions add up a line in the same order (interleaved partial sums, one for each
+ * lane of an AVX2 register, then the remainder), so they give bit-identical results.
+ * Fixed point lengths (see base.h) only have the scalar version, whose sums and products
+ * saturate at the range of ax_length.
+ */
+
+struct ax_flex_kernels {
+    const char* name;
+
+    // sum of 'main' and maximum of 'cross' (which is at least 0)
+    void (*line_sums)(const ax_length* main, const ax_length* cross, size_t n,
+                      ax_length* out_main_sum, ax_length* out_cross_max);
+
+    // the factor of each item; 'shrink[i] * main[i]' if the line overflowed, otherwise
+    // 'grow[i]'. returns their sum.
+    ax_length (*factors)(const ax_length* main,
+                         const ax_length* grow,
+                         const ax_length* shrink,
+                         size_t n,
+                         bool did_overflow,
+                         ax_length* out_factor);
+
+    // 'main[i]' plus the item's share of 'free_space', by its factor
+    void (*targets)(const ax_length* main, const ax_length* factor, size_t n,
+                    ax_length free_space, ax_length factor_sum,
+                    ax_length* out_main);
+};
+
+extern const struct ax_flex_kernels ax__flex_scalar_kernels;
+
+// NULL if the CPU doesn't support AVX2, or it isn't compiled in
+const struct ax_flex_kernels* ax__flex_avx2_kernels(void);
+
+// the fastest kernels for this CPU
+const struct ax_flex_kernels* ax__flex_kernels(void);
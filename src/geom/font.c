@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "font.h"
+#include "measure.h"
+#include "../backend.h"
+#include "../utils.h"
+
+#define N_BUCKETS 64
+
+struct font_entry {
+    struct font_entry* next_by_desc;
+    struct font_entry* next_by_font;
+    struct ax_font* font;
+    size_t refs;
+    char* desc;
+};
+
+static struct {
+    pthread_mutex_t mx;
+    struct font_entry* by_desc[N_BUCKETS];
+    struct font_entry* by_font[N_BUCKETS];
+    struct ax_font_cache_stats stats;
+} cache = {
+    .mx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline size_t desc_bucket(const char* desc)
+{
+    return ax__hash_str(desc) % N_BUCKETS;
+}
+
+static inline size_t font_bucket(const struct ax_font* font)
+{
+    return ax__hash_ptr(font) % N_BUCKETS;
+}
+
+static struct font_entry* find_by_desc(const char* desc)
+{
+    struct font_entry* e = cache.by_desc[desc_bucket(desc)];
+    while (e != NULL && strcmp(e->desc, desc) != 0) {
+        e = e->next_by_desc;
+    }
+    return e;
+}
+
+static struct font_entry* find_by_font(const struct ax_font* font)
+{
+    struct font_entry* e = cache.by_font[font_bucket(font)];
+    while (e != NULL && e->font != font) {
+        e = e->next_by_font;
+    }
+    return e;
+}
+
+int ax__acquire_font(struct ax_state* s,
+                     struct ax_backend* bac,
+                     const char* description,
+                     struct ax_font** out_font)
+{
+    int rv = 0;
+    pthread_mutex_lock(&cache.mx);
+
+    struct font_entry* e = find_by_desc(description);
+    if (e != NULL) {
+        cache.stats.hits++;
+        e->refs++;
+        *out_font = e->font;
+        goto done;
+    }
+
+    cache.stats.misses++;
+    struct ax_font* font;
+    if ((rv = ax__new_font(s, bac, description, &font)) != 0) {
+        goto done;
+    }
+
+    e = malloc(sizeof(struct font_entry));
+    ASSERT(e != NULL, "malloc font cache entry");
+    e->font = font;
+    e->refs = 1;
+    e->desc = malloc(strlen(description) + 1);
+    ASSERT(e->desc != NULL, "malloc font description");
+    strcpy(e->desc, description);
+
+    size_t db = desc_bucket(description), fb = font_bucket(font);
+    e->next_by_desc = cache.by_desc[db];
+    cache.by_desc[db] = e;
+    e->next_by_font = cache.by_font[fb];
+    cache.by_font[fb] = e;
+    cache.stats.n_fonts++;
+    *out_font = font;
+
+done:
+    pthread_mutex_unlock(&cache.mx);
+    return rv;
+}
+
+void ax__release_font(struct ax_font* font)
+{
+    if (font == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache.mx);
+    struct font_entry* e = find_by_font(font);
+    ASSERT(e != NULL, "releasing font that isn't in the cache");
+    ASSERT(e->refs > 0, "font released too many times");
+    e->refs--;
+    pthread_mutex_unlock(&cache.mx);
+}
+
+static void unlink_by_font(struct font_entry* e)
+{
+    struct font_entry** p = &cache.by_font[font_bucket(e->font)];
+    while (*p != e) {
+        p = &(*p)->next_by_font;
+    }
+    *p = e->next_by_font;
+}
+
+void ax__purge_fonts(void)
+{
+    pthread_mutex_lock(&cache.mx);
+    for (size_t i = 0; i < N_BUCKETS; i++) {
+        struct font_entry** p = &cache.by_desc[i];
+        while (*p != NULL) {
+            struct font_entry* e = *p;
+            if (e->refs > 0) {
+                p = &e->next_by_desc;
+                continue;
+            }
+            *p = e->next_by_desc;
+            unlink_by_font(e);
+            ax__measure_cache_forget_font(e->font);
+            ax__destroy_font(e->font);
+            free(e->desc);
+            free(e);
+            cache.stats.n_fonts--;
+        }
+    }
+    pthread_mutex_unlock(&cache.mx);
+}
+
+void ax__font_cache_stats(struct ax_font_cache_stats* out_stats)
+{
+    pthread_mutex_lock(&cache.mx);
+    *out_stats = cache.stats;
+    pthread_mutex_unlock(&cache.mx);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdlib.h>
+
+struct ax_state;
+struct ax_backend;
+struct ax_font;
+
+/*
+ * Process-wide font cache. Fonts are interned by their description string and shared
+ * between every node (and every ax_state) that asks for the same description. Handles
+ * are refcounted; a font whose last reference is released stays cached until
+ * ax__purge_fonts() is called.
+ */
+
+struct ax_font_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t n_fonts;
+};
+
+int ax__acquire_font(struct ax_state* s, // used for ax__set_error()
+                     struct ax_backend* bac,
+                     const char* description,
+                     struct ax_font** out_font);
+
+void ax__release_font(struct ax_font* font);
+
+void ax__purge_fonts(void);
+
+void ax__font_cache_stats(struct ax_font_cache_stats* out_stats);
@@ -1,22 +1,173 @@
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #define AX_DEFINE_TRAVERSAL_MACROS
 #include "text.h"
+#include "flex.h"
+#include "../ax.h"
 #include "../geom.h"
 #include "../tree.h"
 #include "../backend.h"
 #include "../utils.h"
 
+static void* worker_thd(void* arg)
+{
+    struct ax_layout_thread* t = arg;
+    struct ax_geom* g = t->g;
+    pthread_mutex_lock(&g->pool_mx);
+    for (;;) {
+        while (!g->quit && g->pass == t->pass) {
+            pthread_cond_wait(&g->pass_cv, &g->pool_mx);
+        }
+        if (g->quit) {
+            break;
+        }
+        t->pass = g->pass;
+        ax_layout_pass_fn fn = g->pass_fn;
+        void* pass_arg = g->pass_arg;
+        pthread_mutex_unlock(&g->pool_mx);
+        fn(g, t->k, pass_arg);
+        pthread_mutex_lock(&g->pool_mx);
+        if (++g->n_done == g->n_workers - 1) {
+            pthread_cond_signal(&g->done_cv);
+        }
+    }
+    pthread_mutex_unlock(&g->pool_mx);
+    return NULL;
+}
+
+static void init_worker(struct ax_layout_worker* w)
+{
+    ax__init_region(&w->temp_rgn);
+    ax__init_growable(&w->work, sizeof(node_id) * 256);
+    ax__init_growable(&w->row_requests, sizeof(struct ax_event) * 4);
+    w->hypoth_memo = w->wrap_memo = (struct ax_layout_memo) {
+        .cap = 0, .count = 0, .gen = 1, .entries = NULL,
+    };
+    w->wrap_pool = NULL;
+}
+
+static void free_worker(struct ax_layout_worker* w)
+{
+    free(w->wrap_memo.entries);
+    free(w->hypoth_memo.entries);
+    ax__free_growable(&w->row_requests);
+    ax__free_growable(&w->work);
+    ax__free_region(&w->temp_rgn);
+}
+
+static void stop_workers(struct ax_geom* g)
+{
+    pthread_mutex_lock(&g->pool_mx);
+    g->quit = true;
+    pthread_cond_broadcast(&g->pass_cv);
+    pthread_mutex_unlock(&g->pool_mx);
+    for (size_t k = 1; k < g->n_workers; k++) {
+        pthread_join(g->threads[k].thd, NULL);
+        free_worker(&g->workers[k]);
+    }
+    for (size_t k = 0; g->workers_started && k < g->n_workers; k++) {
+        pthread_mutex_destroy(&g->deques[k].mx);
+    }
+    g->quit = false;
+    g->n_workers = 1;
+    g->workers_started = false;
+}
+
+// starts the threads for up to 'max_workers' workers, unless that was already tried.
+// (workers[0] stays where it is, so this can be called in the middle of a layout.)
+static void start_workers(struct ax_geom* g)
+{
+    if (g->workers_started) {
+        return;
+    }
+    g->workers_started = true;
+    pthread_mutex_init(&g->deques[0].mx, NULL);
+    size_t k;
+    for (k = 1; k < g->max_workers; k++) {
+        init_worker(&g->workers[k]);
+        pthread_mutex_init(&g->deques[k].mx, NULL);
+        g->threads[k] = (struct ax_layout_thread) { .g = g, .k = k, .pass = g->pass };
+        if (pthread_create(&g->threads[k].thd, NULL, worker_thd, &g->threads[k]) != 0) {
+            // (the workers that did start still do all of the work)
+            pthread_mutex_destroy(&g->deques[k].mx);
+            free_worker(&g->workers[k]);
+            break;
+        }
+    }
+    g->n_workers = k;
+}
+
+void ax__set_layout_workers(struct ax_geom* g, size_t n)
+{
+    stop_workers(g);
+    if (n > AX_PARALLEL_LAYOUT_MAX_WORKERS) {
+        n = AX_PARALLEL_LAYOUT_MAX_WORKERS;
+    }
+    n = n < 1 ? 1 : n;
+    // (the arrays only move here, while nothing else points into them)
+    g->workers = realloc(g->workers, sizeof(struct ax_layout_worker) * n);
+    g->deques = realloc(g->deques, sizeof(struct ax_layout_deque) * n);
+    g->threads = realloc(g->threads, sizeof(struct ax_layout_thread) * n);
+    ASSERT(g->workers != NULL && g->deques != NULL && g->threads != NULL,
+           "realloc layout workers");
+    g->max_workers = n;
+}
+
+// calls 'fn' for each worker, on its thread, and waits for all of them to return.
+static void run_pass(struct ax_geom* g, ax_layout_pass_fn fn, void* arg)
+{
+    pthread_mutex_lock(&g->pool_mx);
+    g->pass_fn = fn;
+    g->pass_arg = arg;
+    g->n_done = 0;
+    g->pass++;
+    pthread_cond_broadcast(&g->pass_cv);
+    pthread_mutex_unlock(&g->pool_mx);
+    fn(g, 0, arg);
+    pthread_mutex_lock(&g->pool_mx);
+    while (g->n_done < g->n_workers - 1) {
+        pthread_cond_wait(&g->done_cv, &g->pool_mx);
+    }
+    pthread_mutex_unlock(&g->pool_mx);
+}
+
 void ax__init_geom(struct ax_geom* g)
 {
     g->root_dim = AX_DIM(0.0, 0.0);
-    ax__init_region(&g->layout_rgn);
-    ax__init_region(&g->temp_rgn);
+    ax__init_growable(&g->top, sizeof(node_id) * 256);
+    ax__init_growable(&g->tasks, sizeof(node_id) * 256);
+    ax__init_growable(&g->row_requests, sizeof(struct ax_event) * 4);
+
+    pthread_mutex_init(&g->pool_mx, NULL);
+    pthread_cond_init(&g->pass_cv, NULL);
+    pthread_cond_init(&g->done_cv, NULL);
+    g->n_workers = 1;
+    g->workers_started = false;
+    g->pass = g->n_done = 0;
+    g->quit = false;
+    g->workers = NULL;
+    g->deques = NULL;
+    g->threads = NULL;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ax__set_layout_workers(g, n_cpus < 1 ? 1 : (size_t) n_cpus);
+    init_worker(&g->workers[0]);
+    g->workers[0].wrap_pool = g;
 }
 
 void ax__free_geom(struct ax_geom* g)
 {
-    ax__free_region(&g->temp_rgn);
-    ax__free_region(&g->layout_rgn);
+    stop_workers(g);
+    pthread_cond_destroy(&g->done_cv);
+    pthread_cond_destroy(&g->pass_cv);
+    pthread_mutex_destroy(&g->pool_mx);
+    ax__free_growable(&g->row_requests);
+    ax__free_growable(&g->tasks);
+    ax__free_growable(&g->top);
+    free_worker(&g->workers[0]);
+    free(g->threads);
+    free(g->deques);
+    free(g->workers);
 }
 
 #define MAIN(_d) (_d).w
@@ -24,22 +175,181 @@ void ax__free_geom(struct ax_geom* g)
 #define MAX(_x, _y) (((_x) > (_y)) ? (_x) : (_y))
 #define MIN(_x, _y) ((_x) < (_y)) ? (_x) : (_y)
 
-/* IMPORTANT NOTES ABOUT THE TWO KINDS OF REGIONS:
- * - allocate in "rgn" if the memory should persist after individual layout
- *   passes (i.e., it's used in the next pass, or it's used for drawing).
+// geometry of a node, from the tree's arrays
+#define AVAIL(_n)   (tr->avail[ax__node_id(tr, _n)])
+#define HYPOTH(_n)  (tr->hypoth[ax__node_id(tr, _n)])
+#define TARGET(_n)  (tr->target[ax__node_id(tr, _n)])
+#define COORD(_n)   (tr->coord[ax__node_id(tr, _n)])
+#define DIRTY(_n)   (tr->dirty[ax__node_id(tr, _n)])
+#define HASH(_n)    (tr->hash[ax__node_id(tr, _n)])
+#define EXTENT(_n)  (tr->extent[ax__node_id(tr, _n)])
+#define WINDOW()    (tr->target[0])
+
+static bool same_dim(struct ax_dim a, struct ax_dim b)
+{
+    return !(a.w < b.w) && !(a.w > b.w) && !(a.h < b.h) && !(a.h > b.h);
+}
+
+static bool same_pos(struct ax_pos a, struct ax_pos b)
+{
+    return !(a.x < b.x) && !(a.x > b.x) && !(a.y < b.y) && !(a.y > b.y);
+}
+
+/* IMPORTANT NOTES ABOUT MEMORY:
+ * - results that persist after individual layout passes (i.e., they're used in the next
+ *   pass, by the next layout, or for drawing) go in the tree's arrays or in the node,
+ *   since clean nodes keep them from one layout to the next.
  * - allocate in "tmp_rgn" if the memory is temporary and only used for processing this
  *   single node (i.e., if you had used malloc, you would free that memory at the bottom
  *   of the function). you should clear the temp region before using it.
  */
 
+static void memo_clear(struct ax_layout_memo* m)
+{
+    m->count = 0;
+    if (++m->gen == 0) {
+        // (wrapped around, so entries from long ago would look current)
+        for (size_t i = 0; i < m->cap; i++) {
+            m->entries[i].gen = 0;
+        }
+        m->gen = 1;
+    }
+}
+
+static struct ax_layout_memo_entry* memo_slot(struct ax_layout_memo* m,
+                                              uint64_t hash,
+                                              struct ax_dim constraint)
+{
+    size_t mask = m->cap - 1;
+    size_t i = hash & mask;
+    while (m->entries[i].gen == m->gen &&
+           !(m->entries[i].hash == hash && same_dim(m->entries[i].constraint, constraint)))
+    {
+        i = (i + 1) & mask;
+    }
+    return &m->entries[i];
+}
+
+static node_id memo_find(struct ax_layout_memo* m, uint64_t hash, struct ax_dim constraint)
+{
+    if (m->count == 0) {
+        return NULL_ID;
+    }
+    struct ax_layout_memo_entry* e = memo_slot(m, hash, constraint);
+    return e->gen == m->gen ? e->id : NULL_ID;
+}
+
+static void memo_insert(struct ax_layout_memo* m,
+                        uint64_t hash,
+                        struct ax_dim constraint,
+                        node_id id)
+{
+    if ((m->count + 1) * 2 > m->cap) {
+        struct ax_layout_memo old = *m;
+        m->cap = old.cap == 0 ? 64 : old.cap * 2;
+        m->count = 0;
+        m->entries = calloc(m->cap, sizeof(struct ax_layout_memo_entry));
+        for (size_t i = 0; i < old.cap; i++) {
+            if (old.entries[i].gen == old.gen) {
+                *memo_slot(m, old.entries[i].hash, old.entries[i].constraint) =
+                    old.entries[i];
+                m->count++;
+            }
+        }
+        free(old.entries);
+    }
+    struct ax_layout_memo_entry* e = memo_slot(m, hash, constraint);
+    if (e->gen != m->gen) {
+        m->count++;
+    }
+    *e = (struct ax_layout_memo_entry) {
+        .hash = hash, .constraint = constraint, .id = id, .gen = m->gen,
+    };
+}
+
+static uint64_t hash_combine(uint64_t h, uint64_t v)
+{
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+// structural hash of the subtree, from everything that its layout depends on (which
+// leaves out colors and keys). the children's hashes must be up to date.
+static uint64_t subtree_hash(struct ax_tree* tr, struct ax_node* node)
+{
+    DEFINE_TRAVERSAL_LOCALS(tr, child);
+    uint64_t h = hash_combine(AX_HASH_INIT, node->ty);
+    h = hash_combine(h, node->grow_factor);
+    h = hash_combine(h, node->shrink_factor);
+    h = hash_combine(h, node->cross_justify);
+    switch (node->ty) {
+
+    case AX_NODE_CONTAINER:
+        h = hash_combine(h, node->c.main_justify);
+        h = hash_combine(h, node->c.cross_justify);
+        h = hash_combine(h, node->c.single_line);
+        FOR_EACH_CHILD(node, child) {
+            h = hash_combine(h, HASH(child));
+        }
+        break;
+
+    case AX_NODE_RECTANGLE:
+        h = hash_combine(h, ax__hash_bytes((const char*) &node->r.size,
+                                           sizeof(struct ax_dim)));
+        break;
+
+    case AX_NODE_TEXT:
+        h = hash_combine(h, node->t.text_hash);
+        h = hash_combine(h, ax__hash_ptr(node->t.font));
+        break;
+
+    case AX_NODE_LIST:
+        h = hash_combine(h, node->l.n_items);
+        h = hash_combine(h, ax__hash_bytes((const char*) &node->l.item_size,
+                                           sizeof(ax_length)));
+        h = hash_combine(h, node->l.first_item);
+        FOR_EACH_CHILD(node, child) {
+            h = hash_combine(h, HASH(child));
+        }
+        break;
+
+    default: NO_SUCH_NODE_TAG();
+    }
+    return h;
+}
+
 static size_t n_children(struct ax_tree* tree, const struct ax_node* node)
 {
-    DEFINE_TRAVERSAL_LOCALS(tree, child);
-    size_t n = 0;
-    FOR_EACH_CHILD(node, child) {
-        n++;
+    return tree->n_children[ax__node_id(tree, node)];
+}
+
+// the length of the rows of 'count' items of a list. (it's computed as a double, so that it
+// saturates rather than overflowing for lists with a lot of items)
+static ax_length list_length(const struct ax_node* node, size_t count)
+{
+    double len = AX_LENGTH_TO_DOUBLE(node->l.item_size) * (double) count;
+    return len < AX_LENGTH_TO_DOUBLE(AX_LENGTH_MAX) ? AX_LENGTH(len) : AX_LENGTH_MAX;
+}
+
+// whether the hypothetical size of a clean node might change, now that its available
+// size changed from 'old_avail' (its current available size is the new one).
+static bool hypoth_depends_on_avail(struct ax_tree* tr,
+                                    struct ax_node* node,
+                                    struct ax_dim old_avail)
+{
+    switch (node->ty) {
+    case AX_NODE_CONTAINER:
+        return true;
+    case AX_NODE_RECTANGLE:
+        return false;
+    case AX_NODE_TEXT:
+        // wrapping gives the same lines for any width between the widest line and the
+        // width that was used (see text_wrap_reusable())
+        return AVAIL(node).w < HYPOTH(node).w || AVAIL(node).w > old_avail.w;
+    case AX_NODE_LIST:
+        // (it's as wide as it can be, and as high as its rows)
+        return AVAIL(node).w < old_avail.w || AVAIL(node).w > old_avail.w;
+    default: NO_SUCH_NODE_TAG();
     }
-    return n;
 }
 
 static void propagate_available_size(struct ax_tree* tr, struct ax_node* node)
@@ -48,11 +358,24 @@ static void propagate_available_size(struct ax_tree* tr, struct ax_node* node)
     switch (node->ty) {
 
     case AX_NODE_CONTAINER:
+    case AX_NODE_LIST: {
         // TODO: apply constraints on container size
+        // (the rows of a list are one item high)
+        struct ax_dim avail = node->ty == AX_NODE_LIST ?
+            AX_DIM(AVAIL(node).w, node->l.item_size) :
+            AVAIL(node);
         FOR_EACH_CHILD(node, child) {
-            child->avail = node->avail;
+            struct ax_dim old_avail = AVAIL(child);
+            AVAIL(child) = avail;
+            if (!DIRTY(child) &&
+                !same_dim(old_avail, AVAIL(child)) &&
+                hypoth_depends_on_avail(tr, child, old_avail))
+            {
+                DIRTY(child) = true;
+            }
         }
         break;
+    }
 
     case AX_NODE_RECTANGLE:
     case AX_NODE_TEXT:
@@ -62,19 +385,23 @@ static void propagate_available_size(struct ax_tree* tr, struct ax_node* node)
     }
 }
 
-static void container_distribute_lines(struct region* rgn,
-                                       struct ax_tree* tr,
-                                       struct ax_node* node)
+// (only for containers that have children)
+static size_t* container_line_count(struct ax_tree* tr, struct ax_node* node)
+{
+    return &tr->line_count[tr->first_child[ax__node_id(tr, node)]];
+}
+
+static void container_distribute_lines(struct ax_tree* tr, struct ax_node* node)
 {
     DEFINE_TRAVERSAL_LOCALS(tr, child);
     size_t max_n = n_children(tr, node);
-    size_t* line_count = ALLOCATES(rgn, size_t, max_n);
+    size_t* line_count = container_line_count(tr, node);
     memset(line_count, 0, sizeof(size_t) * max_n);
-    ax_length const avail_size = MAIN(node->avail);
+    ax_length const avail_size = MAIN(AVAIL(node));
     size_t i = 0;
     ax_length line_size = 0.0;
     FOR_EACH_CHILD(node, child) {
-        ax_length child_size = MAIN(child->hypoth);
+        ax_length child_size = MAIN(HYPOTH(child));
         if (line_count[i] > 0 && line_size + child_size > avail_size) {
             i++;
             line_size = child_size;
@@ -88,30 +415,281 @@ static void container_distribute_lines(struct region* rgn,
     node->c.n_lines = n_lines;
 }
 
-static void container_single_line(struct region* rgn,
-                                  struct ax_tree* tr,
-                                  struct ax_node* node)
+static void container_single_line(struct ax_tree* tr, struct ax_node* node)
 {
-    size_t* line_count = ALLOCATES(rgn, size_t, 1);
+    size_t* line_count = container_line_count(tr, node);
     line_count[0] = n_children(tr, node);
     node->c.line_count = line_count;
     node->c.n_lines = 1;
 }
 
-static void compute_hypothetical_size(struct region* rgn,
-                                      struct region* tmp_rgn,
+// wraps words [first, last) into 'line_buf'. a range other than the first has to start
+// at a paragraph break; its first line break is left to the previous range, which
+// always ends by pushing its final line. the words were already segmented and
+// measured, so this is just arithmetic.
+static void wrap_words(struct growable* line_buf,
+                       const struct ax_text_word* words,
+                       size_t first,
+                       size_t last,
+                       ax_length max_width)
+{
+#define NEW_LINE(_w) ((struct ax_node_t_line)                           \
+                      { .offset = (_w)->offset, .len = (_w)->len, .width = (_w)->width })
+#define EMPTY_LINE(_w) ((struct ax_node_t_line)                         \
+                        { .offset = (_w)->offset, .len = 0, .width = 0.0 })
+    struct ax_node_t_line line = EMPTY_LINE(&words[first]);
+    for (size_t i = first; i < last; i++) {
+        const struct ax_text_word* w = &words[i];
+        for (size_t j = (i == first && first > 0) ? 1 : 0; j < w->newlines; j++) {
+            PUSH(line_buf, &line);
+            line = EMPTY_LINE(w);
+        }
+        if (w->len == 0) {
+            // (end of text)
+            continue;
+        }
+        if (line.len == 0) {
+            line = NEW_LINE(w);
+            continue;
+        }
+        ax_length width = line.width + w->gap_width + w->width;
+        if (width > max_width) {
+            PUSH(line_buf, &line);
+            line = NEW_LINE(w);
+        } else {
+            line.len = w->offset + w->len - line.offset;
+            line.width = width;
+        }
+    }
+    PUSH(line_buf, &line);
+#undef EMPTY_LINE
+#undef NEW_LINE
+}
+
+struct wrap_job {
+    struct growable* out;
+    struct growable buf;
+    size_t first, last;
+};
+
+struct wrap_pass {
+    const struct ax_text_word* words;
+    ax_length max_width;
+    size_t n_jobs;
+    struct wrap_job jobs[AX_PARALLEL_WRAP_MAX_JOBS];
+};
+
+static void wrap_pass_fn(struct ax_geom* g, size_t k, void* arg)
+{
+    struct wrap_pass* p = arg;
+    for (size_t i = k; i < p->n_jobs; i += g->n_workers) {
+        struct wrap_job* job = &p->jobs[i];
+        wrap_words(job->out, p->words, job->first, job->last, p->max_width);
+    }
+}
+
+static size_t n_wrap_jobs(struct ax_geom* pool, size_t n_words)
+{
+    if (pool == NULL || n_words < AX_PARALLEL_WRAP_MIN_WORDS) {
+        return 1;
+    }
+    start_workers(pool);
+    size_t n = pool->n_workers;
+    n = MIN(n, AX_PARALLEL_WRAP_MAX_JOBS);
+    return MIN(n, n_words / (AX_PARALLEL_WRAP_MIN_WORDS / 2));
+}
+
+// number of lines that come before the paragraph starting at word 'para', which don't
+// change when that paragraph (or anything after it) is re-wrapped.
+static size_t lines_before_paragraph(const struct ax_node* node, size_t para)
+{
+    size_t offset = node->t.words[para].offset;
+    size_t lo = 0, hi = node->t.n_lines;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (node->t.lines[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// wraps the text in 'node' at 'max_width', and saves the lines in the node. when the
+// text was already wrapped at this width, only the paragraphs from the first word that
+// changed since then are wrapped again. paragraphs wrap independently of each other, so
+// very large text is split into runs of paragraphs which are wrapped on the workers of
+// 'pool' (if it isn't NULL) and then stitched back together.
+static void text_wrap(struct ax_geom* pool, struct ax_node* node, ax_length max_width)
+{
+    const struct ax_text_word* words = node->t.words;
+    size_t n_words = node->t.n_words;
+    struct growable* line_buf = &node->t.line_buf;
+
+    size_t start = 0;
+    if (!(max_width < node->t.wrap_width) && !(max_width > node->t.wrap_width)) {
+        if (node->t.n_wrapped_words == n_words) {
+            return;
+        }
+        start = node->t.n_wrapped_words;
+        while (start > 0 && words[start].newlines == 0) {
+            start--;
+        }
+    }
+    line_buf->size = lines_before_paragraph(node, start) * sizeof(struct ax_node_t_line);
+
+    // split at the first paragraph break after each even share of the words
+    size_t n_jobs = n_wrap_jobs(pool, n_words - start);
+    struct wrap_pass p = { .words = words, .max_width = max_width, .n_jobs = 0 };
+    size_t first = start;
+    for (size_t k = 1; k <= n_jobs; k++) {
+        size_t last = k == n_jobs ?
+            n_words :
+            MAX(first + 1, start + (n_words - start) * k / n_jobs);
+        while (last < n_words && words[last].newlines == 0) {
+            last++;
+        }
+        if (last <= first) {
+            continue;
+        }
+        p.jobs[p.n_jobs++] = (struct wrap_job) { .first = first, .last = last };
+        first = last;
+    }
+
+    // the first range goes straight into the node's lines
+    p.jobs[0].out = line_buf;
+    for (size_t k = 1; k < p.n_jobs; k++) {
+        ax__init_growable(&p.jobs[k].buf, sizeof(struct ax_node_t_line) * 256);
+        p.jobs[k].out = &p.jobs[k].buf;
+    }
+    if (p.n_jobs > 1) {
+        run_pass(pool, wrap_pass_fn, &p);
+    } else {
+        wrap_words(line_buf, words, p.jobs[0].first, p.jobs[0].last, max_width);
+    }
+    for (size_t k = 1; k < p.n_jobs; k++) {
+        ax__growable_extend_with(line_buf, p.jobs[k].buf.size, p.jobs[k].buf.data);
+        ax__free_growable(&p.jobs[k].buf);
+    }
+
+    node->t.lines = line_buf->data;
+    node->t.n_lines = LEN(line_buf, struct ax_node_t_line);
+    node->t.wrap_width = max_width;
+    node->t.n_wrapped_words = n_words;
+}
+
+// greedy line breaking gives the same breaks for any width between the widest line and
+// the width that was used for wrapping.
+static bool text_wrap_reusable(const struct ax_node* node, ax_length max_width)
+{
+    if (max_width > node->t.wrap_width || node->t.n_wrapped_words < node->t.n_words) {
+        return false;
+    }
+    for (size_t i = 0; i < node->t.n_lines; i++) {
+        if (node->t.lines[i].width > max_width) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether two text nodes would be wrapped into the same lines. (nodes found in a memo by
+// their hash are checked with this, since a hash can collide)
+static bool same_text(const struct ax_node* a, const struct ax_node* b)
+{
+    return a->t.font == b->t.font &&
+        a->t.text_len == b->t.text_len &&
+        memcmp(a->t.text, b->t.text, a->t.text_len) == 0;
+}
+
+// whether two containers with the same available size have the same lines and
+// hypothetical size: they split into lines the same way, and their children have the same
+// sizes.
+static bool same_container_lines(struct ax_tree* tr, node_id a, node_id b)
+{
+    if (tr->n_children[a] != tr->n_children[b] ||
+        ax__node_by_id(tr, a)->c.single_line != ax__node_by_id(tr, b)->c.single_line)
+    {
+        return false;
+    }
+    for (node_id k = 0; k < tr->n_children[a]; k++) {
+        node_id ca = tr->first_child[a] + k, cb = tr->first_child[b] + k;
+        if (ax__node_by_id(tr, ca)->ty != ax__node_by_id(tr, cb)->ty ||
+            !same_dim(tr->hypoth[ca], tr->hypoth[cb]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// wraps the text like text_wrap(). but if another text node with the same text and font
+// was already wrapped at the same width during this layout, its lines are copied.
+static void text_wrap_shared(struct ax_layout_worker* w,
+                             struct ax_tree* tr,
+                             struct ax_node* node,
+                             ax_length max_width)
+{
+    struct ax_node_t* t = &node->t;
+    node_id id = ax__node_id(tr, node);
+    struct ax_dim key = AX_DIM(max_width, 0.0);
+    // (lines of the node's own at this width only need the appended text wrapped)
+    if (max_width < t->wrap_width || max_width > t->wrap_width) {
+        node_id src = memo_find(&w->wrap_memo, tr->hash[id], key);
+        const struct ax_node_t* src_t = ID_IS_NULL(src) ? NULL : &ax__node_by_id(tr, src)->t;
+        if (src_t != NULL &&
+            same_text(node, ax__node_by_id(tr, src)) &&
+            !(src_t->wrap_width < max_width) && !(src_t->wrap_width > max_width) &&
+            src_t->n_wrapped_words == src_t->n_words)
+        {
+            ax__growable_clear(&t->line_buf);
+            ax__growable_extend_with(&t->line_buf,
+                                     sizeof(struct ax_node_t_line) * src_t->n_lines,
+                                     src_t->lines);
+            t->lines = t->line_buf.data;
+            t->n_lines = src_t->n_lines;
+            t->wrap_width = max_width;
+            t->n_wrapped_words = t->n_words;
+            return;
+        }
+    }
+    text_wrap(w->wrap_pool, node, max_width);
+    memo_insert(&w->wrap_memo, tr->hash[id], key, id);
+}
+
+static void compute_hypothetical_size(struct ax_layout_worker* w,
                                       struct ax_tree* tr,
                                       struct ax_node* node)
 {
     struct ax_dim hypoth;
     DEFINE_TRAVERSAL_LOCALS(tr, child);
+    HASH(node) = subtree_hash(tr, node);
     switch (node->ty) {
 
     case AX_NODE_CONTAINER: {
-        if (node->c.single_line) {
-            container_single_line(rgn, tr, node);
+        // an identical subtree with the same available size has the same lines and size
+        node_id src = memo_find(&w->hypoth_memo, HASH(node), AVAIL(node));
+        if (!ID_IS_NULL(src) && same_container_lines(tr, ax__node_id(tr, node), src)) {
+            const struct ax_node* src_node = ax__node_by_id(tr, src);
+            node->c.n_lines = src_node->c.n_lines;
+            node->c.line_count = NULL;
+            if (node->c.n_lines > 0) {
+                node->c.line_count = container_line_count(tr, node);
+                memcpy(node->c.line_count,
+                       src_node->c.line_count,
+                       sizeof(size_t) * node->c.n_lines);
+            }
+            hypoth = tr->hypoth[src];
+            break;
+        }
+        if (n_children(tr, node) == 0) {
+            node->c.line_count = NULL;
+            node->c.n_lines = 0;
+        } else if (node->c.single_line) {
+            container_single_line(tr, node);
         } else {
-            container_distribute_lines(rgn, tr, node);
+            container_distribute_lines(tr, node);
         }
         ax_length main = 0.0, cross = 0.0;
         struct ax_dim line = AX_DIM(0.0, 0.0);
@@ -125,14 +703,15 @@ static void compute_hypothetical_size(struct region* rgn,
                 UPDATE();
                 line = AX_DIM(0.0, 0.0);
             }
-            MAIN(line) = MAIN(line) + MAIN(child->hypoth);
-            CROSS(line) = MAX(CROSS(line), CROSS(child->hypoth));
+            MAIN(line) = MAIN(line) + MAIN(HYPOTH(child));
+            CROSS(line) = MAX(CROSS(line), CROSS(HYPOTH(child)));
         }
         if (i > 0) {
             UPDATE();
         }
-        MAIN(hypoth) = MIN(main, MAIN(node->avail));
-        CROSS(hypoth) = MIN(cross, CROSS(node->avail));
+        MAIN(hypoth) = MIN(main, MAIN(AVAIL(node)));
+        CROSS(hypoth) = MIN(cross, CROSS(AVAIL(node)));
+        memo_insert(&w->hypoth_memo, HASH(node), AVAIL(node), ax__node_id(tr, node));
         break;
 #undef UPDATE_HYPOTH
     }
@@ -142,91 +721,79 @@ static void compute_hypothetical_size(struct region* rgn,
         break;
 
     case AX_NODE_TEXT: {
-        size_t n_lines = 0;
-        ax_length max_w = 0.0, text_h = 0.0, line_sp = 0.0;
-        struct ax_text_iter ti;
-        ax__region_clear(tmp_rgn);
-        ax__text_iter_init(tmp_rgn, &ti, node->t.text);
-        ax__text_iter_set_font(&ti, node->t.font);
-        ti.max_width = node->avail.w;
-        enum ax_text_elem te;
-        do {
-            te = ax__text_iter_next(&ti);
-            switch (te) {
-            case AX_TEXT_WORD:
-                break;
-
-            case AX_TEXT_EOL:
-            case AX_TEXT_END: {
-                struct ax_text_metrics tm;
-                ax__measure_text(node->t.font, ti.line, &tm);
-                max_w = MAX(max_w, tm.width);
-                text_h = tm.text_height;
-                line_sp = tm.line_spacing;
-                n_lines++;
-                break;
-            }
-
-            default: NO_SUCH_TAG("ax_text_elem");
-            }
-        } while (te != AX_TEXT_END);
-
+        const struct ax_font_metrics* fm = ax__font_metrics(node->t.font);
+        text_wrap_shared(w, tr, node, AVAIL(node).w);
+        ax_length max_w = 0.0;
+        for (size_t i = 0; i < node->t.n_lines; i++) {
+            max_w = MAX(max_w, node->t.lines[i].width);
+        }
         hypoth.w = max_w;
-        hypoth.h = text_h + line_sp * (n_lines - 1);
+        // (in fixed point, very tall text saturates. the line count is clamped so that it
+        // fits in a length.)
+        size_t n_gaps = MIN(node->t.n_lines - 1, (size_t) INT32_MAX);
+        hypoth.h = AX_LENGTH_ADD(fm->text_height,
+                                 AX_LENGTH_MUL(fm->line_spacing, (ax_length) n_gaps));
         break;
     }
 
+    case AX_NODE_LIST:
+        hypoth = AX_DIM(AVAIL(node).w, list_length(node, node->l.n_items));
+        break;
+
     default: NO_SUCH_NODE_TAG();
     }
-    node->hypoth = hypoth;
+    HYPOTH(node) = hypoth;
 }
 
-static void resolve_target_size(struct region* tmp_rgn,
+static void resolve_target_size(struct ax_layout_worker* w,
                                 struct ax_tree* tr,
                                 struct ax_node* node)
 {
+    struct region* tmp_rgn = &w->temp_rgn;
     DEFINE_TRAVERSAL_LOCALS(tr, child);
     switch (node->ty) {
 
     case AX_NODE_CONTAINER: {
-        struct line_calc {
-            ax_length factor_sum;
-            ax_length cross_size;
-            ax_length free_space;
-        };
+        // the children's sizes are gathered into dense arrays, so that each line can be
+        // resolved in bulk by the flex kernels. (children of a line are consecutive.)
+        const struct ax_flex_kernels* fk = ax__flex_kernels();
+        size_t n = n_children(tr, node);
         ax__region_clear(tmp_rgn);
-        struct line_calc* lines = ALLOCATES(tmp_rgn, struct line_calc, node->c.n_lines);
-        size_t li, i;
-        for (li = 0; li < node->c.n_lines; li++) {
-            lines[li].factor_sum = 0.0;
-            lines[li].cross_size = 0.0;
-            lines[li].free_space = MAIN(node->target);
-        }
-        FOR_EACH_CHILD_IN_LINES(li, i, node, child) {
-            lines[li].cross_size = MAX(lines[li].cross_size, CROSS(child->hypoth));
-            lines[li].free_space -= MAIN(child->hypoth);
-        }
-#define FACTOR(_n)                                      \
-        (did_overflow ?                                 \
-         ((_n)->shrink_factor * MAIN((_n)->hypoth)) :   \
-         (_n)->grow_factor)
-        FOR_EACH_CHILD_IN_LINES(li, i, node, child) {
-            bool did_overflow = lines[li].free_space < 0;
-            lines[li].factor_sum += FACTOR(child);
+        ax_length* main = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* cross = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* grow = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* shrink = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* factor = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* target_main = ALLOCATES(tmp_rgn, ax_length, n);
+        size_t i = 0;
+        FOR_EACH_CHILD(node, child) {
+            main[i] = MAIN(HYPOTH(child));
+            cross[i] = CROSS(HYPOTH(child));
+            grow[i] = child->grow_factor;
+            shrink[i] = child->shrink_factor;
+            i++;
         }
-        FOR_EACH_CHILD_IN_LINES(li, i, node, child) {
-            bool did_overflow = lines[li].free_space < 0;
-            ax_length flex, factor = FACTOR(child);
-            if (factor > 0) {
-                flex = lines[li].free_space * FACTOR(child) / lines[li].factor_sum;
-            } else {
-                flex = 0.0;
+        node_id first_child = tr->first_child[ax__node_id(tr, node)];
+        size_t first = 0;
+        for (size_t li = 0; li < node->c.n_lines; li++) {
+            size_t len = node->c.line_count[li];
+            ax_length main_sum, cross_size;
+            fk->line_sums(main + first, cross + first, len, &main_sum, &cross_size);
+            ax_length free_space = MAIN(TARGET(node)) - main_sum;
+            ax_length factor_sum = fk->factors(main + first, grow + first, shrink + first,
+                                               len, free_space < 0, factor + first);
+            fk->targets(main + first, factor + first, len, free_space, factor_sum,
+                        target_main + first);
+            for (size_t j = first; j < first + len; j++) {
+                struct ax_dim target = AX_DIM(target_main[j], cross_size);
+                if (!same_dim(tr->target[first_child + j], target)) {
+                    tr->dirty[first_child + j] = true;
+                }
+                tr->target[first_child + j] = target;
             }
-            MAIN(child->target) = MAIN(child->hypoth) + flex;
-            CROSS(child->target) = lines[li].cross_size;
+            first += len;
         }
         break;
-#undef FACTOR
     }
 
     case AX_NODE_RECTANGLE:
@@ -234,6 +801,16 @@ static void resolve_target_size(struct region* tmp_rgn,
         // TODO: re-calculate text? need to determine actual-height somehow
         break;
 
+    case AX_NODE_LIST:
+        FOR_EACH_CHILD(node, child) {
+            struct ax_dim target = AX_DIM(TARGET(node).w, node->l.item_size);
+            if (!same_dim(TARGET(child), target)) {
+                DIRTY(child) = true;
+            }
+            TARGET(child) = target;
+        }
+        break;
+
     default: NO_SUCH_NODE_TAG();
     }
 }
@@ -256,15 +833,15 @@ static ax_length justify_padding(enum ax_justify j, ax_length space,
         offset = space / 2;
         break;
     case AX_JUSTIFY_EVENLY:
-        pad = space / (n_items + 1);
+        pad = space / (ax_length) (n_items + 1);
         offset = pad;
         break;
     case AX_JUSTIFY_AROUND:
-        pad = n_items > 0 ? space / n_items : 0.0;
+        pad = n_items > 0 ? space / (ax_length) n_items : 0.0;
         offset = pad / 2;
         break;
     case AX_JUSTIFY_BETWEEN:
-        pad = n_items > 1 ? space / (n_items - 1) : 0.0;
+        pad = n_items > 1 ? space / (ax_length) (n_items - 1) : 0.0;
         offset = 0.0;
         break;
     default: NO_SUCH_TAG("ax_justify");
@@ -274,11 +851,74 @@ static ax_length justify_padding(enum ax_justify j, ax_length space,
     return pad;
 }
 
-static void place_coords(struct region* rgn,
-                         struct region* tmp_rgn,
+// whether a text node placed at 'coord' with the target size 'target' is outside the
+// window, so that it can go without being wrapped and placed
+static bool text_culled(struct ax_pos coord, struct ax_dim target, struct ax_dim win)
+{
+    return !ax__in_window((struct ax_aabb) { .o = coord, .s = target }, win);
+}
+
+// the items of a list whose rows are in the window, and 'overscan' more on either side, as
+// [*out_first, *out_last). (an empty range if the list is outside the window)
+static void list_wanted_items(struct ax_tree* tr,
+                              const struct ax_node* node,
+                              size_t* out_first,
+                              size_t* out_last)
+{
+    const struct ax_node_l* l = &node->l;
+    struct ax_aabb bounds = { .o = COORD(node), .s = TARGET(node) };
+    double size = AX_LENGTH_TO_DOUBLE(l->item_size);
+    *out_first = *out_last = 0;
+    if (l->n_items == 0 || !(size > 0) || !ax__in_window(bounds, WINDOW())) {
+        return;
+    }
+    double y = AX_LENGTH_TO_DOUBLE(COORD(node).y);
+    double top = -y / size;
+    double bottom = (AX_LENGTH_TO_DOUBLE(WINDOW().h) - y) / size;
+    size_t first = top <= 0 ? 0 : top < (double) l->n_items ? (size_t) top : l->n_items;
+    size_t last = bottom < (double) l->n_items ? (size_t) bottom : l->n_items;
+    if ((double) last < bottom && last < l->n_items) {
+        // (the row that the bottom of the window cuts through)
+        last++;
+    }
+    *out_first = first > l->overscan ? first - l->overscan : 0;
+    *out_last = l->n_items - last > l->overscan ? last + l->overscan : l->n_items;
+}
+
+// asks the client for the rows that the list wants, unless they are its children already,
+// or they were asked for last time too
+static void list_request_rows(struct ax_layout_worker* w,
+                              struct ax_tree* tr,
+                              struct ax_node* node)
+{
+    struct ax_node_l* l = &node->l;
+    size_t first, last;
+    list_wanted_items(tr, node, &first, &last);
+    if (first >= last ||
+        (first >= l->first_item && last <= l->first_item + n_children(tr, node)) ||
+        (first == l->req_first && last - first == l->req_count))
+    {
+        return;
+    }
+    l->req_first = first;
+    l->req_count = last - first;
+    struct ax_event e = {
+        .ty = AX_EVENT_ROWS,
+        .rows = {
+            .id = ax__node_id(tr, node),
+            .key = node->key,
+            .first = first,
+            .count = last - first,
+        },
+    };
+    PUSH(&w->row_requests, &e);
+}
+
+static void place_coords(struct ax_layout_worker* w,
                          struct ax_tree* tr,
                          struct ax_node* node)
 {
+    struct region* tmp_rgn = &w->temp_rgn;
     DEFINE_TRAVERSAL_LOCALS(tr, child);
     switch (node->ty) {
 
@@ -287,29 +927,39 @@ static void place_coords(struct region* rgn,
             ax_length flex_space;
             ax_length cross_size;
         };
+        const struct ax_flex_kernels* fk = ax__flex_kernels();
+        size_t n = n_children(tr, node);
         ax__region_clear(tmp_rgn);
         struct line_calc* lines = ALLOCATES(tmp_rgn, struct line_calc, node->c.n_lines);
-        size_t li, i;
-        for (li = 0; li < node->c.n_lines; li++) {
-            lines[li].flex_space = MAIN(node->target);
-            lines[li].cross_size = 0.0;
+        ax_length* main = ALLOCATES(tmp_rgn, ax_length, n);
+        ax_length* cross = ALLOCATES(tmp_rgn, ax_length, n);
+        size_t li, i = 0;
+        FOR_EACH_CHILD(node, child) {
+            main[i] = MAIN(TARGET(child));
+            cross[i] = CROSS(TARGET(child));
+            i++;
         }
-        FOR_EACH_CHILD_IN_LINES(li, i, node, child) {
-            lines[li].flex_space -= MAIN(child->target);
-            lines[li].cross_size = MAX(lines[li].cross_size, CROSS(child->target));
+        size_t first = 0;
+        for (li = 0; li < node->c.n_lines; li++) {
+            size_t len = node->c.line_count[li];
+            ax_length main_sum;
+            fk->line_sums(main + first, cross + first, len,
+                          &main_sum, &lines[li].cross_size);
+            lines[li].flex_space = MAIN(TARGET(node)) - main_sum;
+            first += len;
         }
-        ax_length cross_flex_space = CROSS(node->target);
+        ax_length cross_flex_space = CROSS(TARGET(node));
         for (li = 0; li < node->c.n_lines; li++) {
             cross_flex_space -= lines[li].cross_size;
         }
         ax_length pad_x, pad_y;
-        ax_length x, y = node->coord.y;
+        ax_length x, y = COORD(node).y;
         pad_y = justify_padding(node->c.cross_justify,
                                 cross_flex_space,
                                 node->c.n_lines,
                                 &y);
 #define START_LINE() do {                                   \
-            x = node->coord.x;                              \
+            x = COORD(node).x;                              \
             pad_x = justify_padding(node->c.main_justify,   \
                                     lines[li].flex_space,   \
                                     node->c.line_count[li], \
@@ -323,12 +973,16 @@ static void place_coords(struct region* rgn,
                 prev_li = li;
                 START_LINE();
             }
-            child->coord = AX_POS(x, y);
+            struct ax_pos coord = AX_POS(x, y);
             justify_padding(child->cross_justify,
-                            lines[li].cross_size - CROSS(child->target),
+                            lines[li].cross_size - CROSS(TARGET(child)),
                             1,
-                            &child->coord.y);
-            x += MAIN(child->target) + pad_x;
+                            &coord.y);
+            if (!same_pos(COORD(child), coord)) {
+                DIRTY(child) = true;
+            }
+            COORD(child) = coord;
+            x += MAIN(TARGET(child)) + pad_x;
         }
         break;
 #undef START_LINE
@@ -338,42 +992,33 @@ static void place_coords(struct region* rgn,
         break;
 
     case AX_NODE_TEXT: {
-        struct ax_pos coord = node->coord;
-        struct ax_node_t_line* first_line = NULL, *prev_line = NULL;
-        struct ax_text_metrics tm; // TODO: helper function "ax__measure_line_spacing(font)"
-        ax__measure_text(node->t.font, "", &tm);
-        struct ax_text_iter ti;
-        ax__region_clear(tmp_rgn);
-        ax__text_iter_init(tmp_rgn, &ti, node->t.text);
-        ax__text_iter_set_font(&ti, node->t.font);
-        ti.max_width = node->target.w;
-        enum ax_text_elem te;
-        do {
-            te = ax__text_iter_next(&ti);
-            switch (te) {
-            case AX_TEXT_WORD:
-                break;
-
-            case AX_TEXT_EOL:
-            case AX_TEXT_END: {
-                struct ax_node_t_line* line = ALLOCATE(rgn, struct ax_node_t_line);
-                line->next = NULL;
-                line->coord = coord;
-                line->str = ax__strdup(rgn, ti.line);
-                coord.y += tm.line_spacing;
-                if (first_line == NULL) {
-                    first_line = line;
-                } else {
-                    prev_line->next = line;
-                }
-                prev_line = line;
-                break;
-            }
+        struct ax_pos coord = COORD(node);
+        node->t.culled = text_culled(coord, TARGET(node), WINDOW());
+        if (node->t.culled) {
+            break;
+        }
+        const struct ax_font_metrics* fm = ax__font_metrics(node->t.font);
+        if (!text_wrap_reusable(node, TARGET(node).w)) {
+            text_wrap_shared(w, tr, node, TARGET(node).w);
+        }
+        for (size_t i = 0; i < node->t.n_lines; i++) {
+            node->t.lines[i].coord = coord;
+            coord.y = AX_LENGTH_ADD(coord.y, fm->line_spacing);
+        }
+        break;
+    }
 
-            default: NO_SUCH_TAG("ax_text_elem");
+    case AX_NODE_LIST: {
+        size_t item = node->l.first_item;
+        FOR_EACH_CHILD(node, child) {
+            struct ax_pos coord = AX_POS(COORD(node).x,
+                                         COORD(node).y + list_length(node, item++));
+            if (!same_pos(COORD(child), coord)) {
+                DIRTY(child) = true;
             }
-        } while (te != AX_TEXT_END);
-        node->t.lines = first_line;
+            COORD(child) = coord;
+        }
+        list_request_rows(w, tr, node);
         break;
     }
 
@@ -381,33 +1026,302 @@ static void place_coords(struct region* rgn,
     }
 }
 
+// computes the extent of a node that was just placed. (its children's extents are
+// already up to date.)
+static void update_extent(struct ax_tree* tr, struct ax_node* node)
+{
+    DEFINE_TRAVERSAL_LOCALS(tr, child);
+    struct ax_pos lo = COORD(node);
+    struct ax_pos hi = AX_POS(lo.x + TARGET(node).w, lo.y + TARGET(node).h);
+    switch (node->ty) {
 
-void ax__layout(struct ax_tree* tr, struct ax_geom* g)
+    case AX_NODE_CONTAINER:
+    case AX_NODE_LIST:
+        FOR_EACH_CHILD(node, child) {
+            struct ax_aabb e = EXTENT(child);
+            lo.x = MIN(lo.x, e.o.x);
+            lo.y = MIN(lo.y, e.o.y);
+            hi.x = MAX(hi.x, e.o.x + e.s.w);
+            hi.y = MAX(hi.y, e.o.y + e.s.h);
+        }
+        break;
+
+    case AX_NODE_RECTANGLE:
+        hi.x = MAX(hi.x, lo.x + node->r.size.w);
+        hi.y = MAX(hi.y, lo.y + node->r.size.h);
+        break;
+
+    case AX_NODE_TEXT:
+        if (!node->t.culled && node->t.n_lines > 0) {
+            const struct ax_font_metrics* fm = ax__font_metrics(node->t.font);
+            for (size_t i = 0; i < node->t.n_lines; i++) {
+                hi.x = MAX(hi.x, lo.x + node->t.lines[i].width);
+            }
+            hi.y = MAX(hi.y, node->t.lines[node->t.n_lines - 1].coord.y + fm->text_height);
+        }
+        break;
+
+    default: NO_SUCH_NODE_TAG();
+    }
+    EXTENT(node) = (struct ax_aabb) { .o = lo, .s = AX_DIM(hi.x - lo.x, hi.y - lo.y) };
+}
+
+// a text node outside the window keeps its old lines, and is only placed again when it
+// moves. so when the window changes, this marks the culled text nodes now inside it
+// dirty, looking only at the subtrees that overlap it. the same goes for lists, whose
+// rows depend on which of them are in the window.
+static void uncull_nodes(struct ax_tree* tr, struct growable* stack, struct ax_dim win)
 {
-    if (ax__is_tree_empty(tr)) {
-        return;
+    ax__growable_clear(stack);
+    node_id id = 0;
+    PUSH(stack, &id);
+    while (!ax__is_growable_empty(stack)) {
+        ax__growable_retract_into(stack, sizeof(node_id), &id);
+        // (the extent of a dirty node is out of date, but it's laid out anyway)
+        if (!tr->dirty[id] && !ax__in_window(tr->extent[id], win)) {
+            continue;
+        }
+        struct ax_node* node = ax__node_by_id(tr, id);
+        if ((node->ty == AX_NODE_TEXT && node->t.culled &&
+             !text_culled(tr->coord[id], tr->target[id], win)) ||
+            node->ty == AX_NODE_LIST)
+        {
+            ax__tree_mark_dirty(tr, id);
+        }
+        for (node_id k = 0; k < tr->n_children[id]; k++) {
+            node_id child = tr->first_child[id] + k;
+            PUSH(stack, &child);
+        }
     }
+}
 
-    DEFINE_TRAVERSAL_LOCALS(tr, node);
+#define LIST_NODE(_list, _i)  ax__node_by_id(tr, ((node_id*) (_list)->data)[_i])
 
-    ax__region_clear(&g->layout_rgn);
+// queues the dirty children of the node, to be processed after it
+static void push_dirty_children(struct ax_tree* tr,
+                                struct growable* list,
+                                struct ax_node* node)
+{
+    DEFINE_TRAVERSAL_LOCALS(tr, child);
+    FOR_EACH_CHILD(node, child) {
+        if (DIRTY(child)) {
+            node_id id = ax__node_id(tr, child);
+            PUSH(list, &id);
+        }
+    }
+}
 
-    ax__root(tr)->avail = g->root_dim;
-    FOR_EACH_FROM_TOP(node) {
+// the two passes up to the hypothetical sizes, for the dirty part of the subtree 'root'
+// (whose available size is set already)
+static void layout_up(struct ax_layout_worker* w, struct ax_tree* tr, node_id root)
+{
+    struct growable* list = &w->work;
+    ax__growable_clear(list);
+    PUSH(list, &root);
+    for (size_t i = 0; i < LEN(list, node_id); i++) {
+        struct ax_node* node = LIST_NODE(list, i);
         propagate_available_size(tr, node);
+        push_dirty_children(tr, list, node);
+    }
+    for (size_t i = LEN(list, node_id); i > 0; i--) {
+        compute_hypothetical_size(w, tr, LIST_NODE(list, i - 1));
     }
+}
 
-    FOR_EACH_FROM_BOTTOM(node) {
-        compute_hypothetical_size(&g->layout_rgn, &g->temp_rgn, tr, node);
+// the two passes after that, once the target size and position of 'root' are set. (a
+// node's position only depends on its parent, so both passes are done for each node in
+// turn.)
+static void layout_down(struct ax_layout_worker* w, struct ax_tree* tr, node_id root)
+{
+    struct growable* list = &w->work;
+    ax__growable_clear(list);
+    PUSH(list, &root);
+    for (size_t i = 0; i < LEN(list, node_id); i++) {
+        struct ax_node* node = LIST_NODE(list, i);
+        resolve_target_size(w, tr, node);
+        place_coords(w, tr, node);
+        DIRTY(node) = false;
+        push_dirty_children(tr, list, node);
+    }
+    for (size_t i = LEN(list, node_id); i > 0; i--) {
+        update_extent(tr, LIST_NODE(list, i - 1));
     }
+}
+
+struct layout_pass {
+    struct ax_tree* tr;
+    bool up;
+};
 
-    ax__root(tr)->target = g->root_dim;
-    FOR_EACH_FROM_TOP(node) {
-        resolve_target_size(&g->temp_rgn, tr, node);
+// takes a task from the worker's own deque, or steals one from another's
+static bool next_task(struct ax_geom* g, size_t k, node_id* out_root)
+{
+    const node_id* tasks = g->tasks.data;
+    for (size_t j = 0; j < g->n_workers; j++) {
+        struct ax_layout_deque* d = &g->deques[(k + j) % g->n_workers];
+        pthread_mutex_lock(&d->mx);
+        bool found = d->front < d->back;
+        if (found) {
+            *out_root = j == 0 ? tasks[--d->back] : tasks[d->front++];
+        }
+        pthread_mutex_unlock(&d->mx);
+        if (found) {
+            return true;
+        }
     }
+    return false;
+}
 
-    ax__root(tr)->coord = AX_POS(0.0, 0.0);
-    FOR_EACH_FROM_TOP(node) {
-        place_coords(&g->layout_rgn, &g->temp_rgn, tr, node);
+static void layout_pass_fn(struct ax_geom* g, size_t k, void* arg)
+{
+    struct layout_pass* p = arg;
+    struct ax_layout_worker* w = &g->workers[k];
+    node_id root;
+    while (next_task(g, k, &root)) {
+        if (p->up) {
+            layout_up(w, p->tr, root);
+        } else {
+            layout_down(w, p->tr, root);
+        }
+    }
+}
+
+// runs layout_up() or layout_down() on each of the subtrees in 'g->tasks', on all of the
+// workers. the subtrees don't overlap, and each worker only reads the results in its own
+// memos, so the results don't depend on which worker gets which subtree.
+static void run_tasks(struct ax_geom* g, struct ax_tree* tr, bool up)
+{
+    size_t n_tasks = LEN(&g->tasks, node_id);
+    if (n_tasks == 0) {
+        return;
+    }
+    for (size_t k = 0; k < g->n_workers; k++) {
+        // (a memo may refer to nodes that another worker is about to change)
+        memo_clear(&g->workers[k].hypoth_memo);
+        memo_clear(&g->workers[k].wrap_memo);
+        g->deques[k].front = n_tasks * k / g->n_workers;
+        g->deques[k].back = n_tasks * (k + 1) / g->n_workers;
+    }
+    struct layout_pass p = { .tr = tr, .up = up };
+    // (large text in the subtrees is wrapped by whichever worker finds it)
+    g->workers[0].wrap_pool = NULL;
+    run_pass(g, layout_pass_fn, &p);
+    g->workers[0].wrap_pool = g;
+}
+
+// lays out the levels nearest the root on this thread, until a level of the dirty part
+// of the tree has enough nodes to keep the workers busy. the subtrees below that level
+// are the tasks.
+static void layout_parallel(struct ax_geom* g, struct ax_tree* tr)
+{
+    struct ax_layout_worker* w0 = &g->workers[0];
+    struct growable* top = &g->top;
+    size_t min_tasks = g->n_workers * AX_PARALLEL_LAYOUT_TASKS_PER_WORKER;
+    node_id root = 0;
+
+    ax__growable_clear(top);
+    PUSH(top, &root);
+    size_t begin = 0, end = 1, depth = 0;
+    while (begin < end && end - begin < min_tasks) {
+        for (size_t i = begin; i < end; i++) {
+            struct ax_node* node = LIST_NODE(top, i);
+            propagate_available_size(tr, node);
+            push_dirty_children(tr, top, node);
+        }
+        begin = end;
+        end = LEN(top, node_id);
+        depth++;
+    }
+    ax__growable_clear(&g->tasks);
+    ax__growable_extend_with(&g->tasks, (end - begin) * sizeof(node_id),
+                             (node_id*) top->data + begin);
+    run_tasks(g, tr, true);
+    for (size_t i = begin; i > 0; i--) {
+        compute_hypothetical_size(w0, tr, LIST_NODE(top, i - 1));
+    }
+
+    // (the levels are the same, but nodes may have been dirtied since)
+    ax__growable_clear(top);
+    PUSH(top, &root);
+    begin = 0;
+    end = 1;
+    for (size_t d = 0; d < depth && begin < end; d++) {
+        for (size_t i = begin; i < end; i++) {
+            struct ax_node* node = LIST_NODE(top, i);
+            resolve_target_size(w0, tr, node);
+            place_coords(w0, tr, node);
+            DIRTY(node) = false;
+            push_dirty_children(tr, top, node);
+        }
+        begin = end;
+        end = LEN(top, node_id);
+    }
+    ax__growable_clear(&g->tasks);
+    ax__growable_extend_with(&g->tasks, (end - begin) * sizeof(node_id),
+                             (node_id*) top->data + begin);
+    run_tasks(g, tr, false);
+    for (size_t i = begin; i > 0; i--) {
+        update_extent(tr, LIST_NODE(top, i - 1));
+    }
+}
+
+static int compare_row_requests(const void* a, const void* b)
+{
+    size_t id_a = ((const struct ax_event*) a)->rows.id;
+    size_t id_b = ((const struct ax_event*) b)->rows.id;
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+// gathers the rows that the lists asked for into 'g->row_requests', in the order of the
+// lists' ids. (which worker placed which list depends on the stealing.)
+static void collect_row_requests(struct ax_geom* g)
+{
+    for (size_t k = 0; k < g->n_workers; k++) {
+        struct growable* reqs = &g->workers[k].row_requests;
+        ax__growable_extend_with(&g->row_requests, reqs->size, reqs->data);
+        ax__growable_clear(reqs);
+    }
+    qsort(g->row_requests.data, LEN(&g->row_requests, struct ax_event),
+          sizeof(struct ax_event), compare_row_requests);
+}
+
+void ax__layout(struct ax_tree* tr, struct ax_geom* g)
+{
+    ax__growable_clear(&g->row_requests);
+    if (ax__is_tree_empty(tr)) {
+        return;
+    }
+
+    // only dirty nodes are processed. a dirty node marks a child dirty when it gives it
+    // a different constraint (available size, target size or position) than last time,
+    // and the result that the child has for its old constraint might not hold. the
+    // other children keep the geometry they have, as if it came from a cache.
+    //
+    // the passes go through lists of the dirty nodes, each after its parent, so they
+    // only visit the dirty part of the tree: for a single changed node, that's the path
+    // to the root.
+    if (!same_dim(tr->avail[0], g->root_dim)) {
+        tr->dirty[0] = true;
+        uncull_nodes(tr, &g->top, g->root_dim);
+    }
+    tr->avail[0] = g->root_dim;
+    tr->target[0] = g->root_dim;
+    tr->coord[0] = AX_POS(0.0, 0.0);
+    if (!tr->dirty[0]) {
+        return;
+    }
+
+    struct ax_layout_worker* w0 = &g->workers[0];
+    memo_clear(&w0->hypoth_memo);
+    memo_clear(&w0->wrap_memo);
+    if (ax__tree_count(tr) >= AX_PARALLEL_LAYOUT_MIN_NODES) {
+        start_workers(g);
+    }
+    if (g->n_workers > 1 && ax__tree_count(tr) >= AX_PARALLEL_LAYOUT_MIN_NODES) {
+        layout_parallel(g, tr);
+    } else {
+        layout_up(w0, tr, 0);
+        layout_down(w0, tr, 0);
     }
+    collect_row_requests(g);
 }
@@ -0,0 +1,252 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "measure.h"
+#include "text.h"
+#include "../backend.h"
+#include "../utils.h"
+
+#define N_BUCKETS (AX_MEASURE_CACHE_CAPACITY * 2)
+
+struct measure_entry {
+    struct measure_entry* next_in_bucket;
+    // LRU list; 'newer' points towards the most recently used entry
+    struct measure_entry* newer;
+    struct measure_entry* older;
+    struct ax_font* font;
+    size_t hash;
+    struct ax_text_metrics tm;
+    size_t len;
+    char str[];
+};
+
+static struct {
+    pthread_mutex_t mx;
+    struct measure_entry* buckets[N_BUCKETS];
+    struct measure_entry* newest;
+    struct measure_entry* oldest;
+    struct ax_measure_cache_stats stats;
+} cache = {
+    .mx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline size_t key_hash(const struct ax_font* font, const char* str, size_t len)
+{
+    return ax__hash_bytes(str, len) ^ ax__hash_ptr(font);
+}
+
+static struct measure_entry* lookup(const struct ax_font* font, const char* str,
+                                    size_t len, size_t hash)
+{
+    struct measure_entry* e = cache.buckets[hash % N_BUCKETS];
+    while (e != NULL &&
+           !(e->hash == hash && e->font == font && e->len == len &&
+             memcmp(e->str, str, len) == 0)) {
+        e = e->next_in_bucket;
+    }
+    return e;
+}
+
+static void lru_unlink(struct measure_entry* e)
+{
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        cache.newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        cache.oldest = e->newer;
+    }
+}
+
+static void lru_push_newest(struct measure_entry* e)
+{
+    e->newer = NULL;
+    e->older = cache.newest;
+    if (cache.newest != NULL) {
+        cache.newest->newer = e;
+    } else {
+        cache.oldest = e;
+    }
+    cache.newest = e;
+}
+
+static void remove_entry(struct measure_entry* e)
+{
+    struct measure_entry** p = &cache.buckets[e->hash % N_BUCKETS];
+    while (*p != e) {
+        p = &(*p)->next_in_bucket;
+    }
+    *p = e->next_in_bucket;
+    lru_unlink(e);
+    free(e);
+    cache.stats.n_entries--;
+}
+
+static void insert(struct ax_font* font, const char* str, size_t len, size_t hash,
+                   const struct ax_text_metrics* tm)
+{
+    if (lookup(font, str, len, hash) != NULL) {
+        // another thread measured the same string in the meantime
+        return;
+    }
+    if (cache.stats.n_entries >= AX_MEASURE_CACHE_CAPACITY) {
+        remove_entry(cache.oldest);
+        cache.stats.evictions++;
+    }
+    struct measure_entry* e = malloc(sizeof(struct measure_entry) + len);
+    ASSERT(e != NULL, "malloc measure cache entry");
+    e->font = font;
+    e->hash = hash;
+    e->tm = *tm;
+    e->len = len;
+    memcpy(e->str, str, len);
+    size_t b = hash % N_BUCKETS;
+    e->next_in_bucket = cache.buckets[b];
+    cache.buckets[b] = e;
+    lru_push_newest(e);
+    cache.stats.n_entries++;
+}
+
+// adds up glyph advances from the font's table. returns false if some character isn't
+// in the table, in which case the backend has to measure it.
+static bool measure_from_table(struct ax_font* font,
+                               const char* text,
+                               size_t len,
+                               struct ax_text_metrics* out_metrics)
+{
+    const struct ax_font_metrics* fm = ax__font_metrics(font);
+    ax_length width = 0.0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = text[i];
+        if (ch >= AX_FONT_N_ADVANCES || fm->advances[ch] < 0.0) {
+            return false;
+        }
+        width += fm->advances[ch];
+    }
+    out_metrics->width = width;
+    out_metrics->text_height = fm->text_height;
+    out_metrics->line_spacing = fm->line_spacing;
+    return true;
+}
+
+void ax__measure_text_cached(struct ax_font* font,
+                             const char* text,
+                             size_t len,
+                             struct ax_text_metrics* out_metrics)
+{
+    if (measure_from_table(font, text, len, out_metrics)) {
+        return;
+    }
+
+    size_t hash = key_hash(font, text, len);
+
+    pthread_mutex_lock(&cache.mx);
+    struct measure_entry* e = lookup(font, text, len, hash);
+    if (e != NULL) {
+        cache.stats.hits++;
+        lru_unlink(e);
+        lru_push_newest(e);
+        *out_metrics = e->tm;
+        pthread_mutex_unlock(&cache.mx);
+        return;
+    }
+    cache.stats.misses++;
+    pthread_mutex_unlock(&cache.mx);
+
+    // don't hold the lock while the backend does the actual work
+    ax__measure_text(font, text, len, out_metrics);
+
+    pthread_mutex_lock(&cache.mx);
+    insert(font, text, len, hash, out_metrics);
+    pthread_mutex_unlock(&cache.mx);
+}
+
+static void measure_chunk(struct ax_font* font,
+                          const char* text,
+                          const struct ax_text_span* spans,
+                          size_t n,
+                          ax_length* out_widths)
+{
+    struct ax_text_metrics tm;
+    size_t miss_idxs[AX_MEASURE_BATCH_CHUNK];
+    size_t hashes[AX_MEASURE_BATCH_CHUNK];
+    struct ax_text_span miss_spans[AX_MEASURE_BATCH_CHUNK];
+    ax_length miss_widths[AX_MEASURE_BATCH_CHUNK];
+    size_t n_misses = 0;
+
+    pthread_mutex_lock(&cache.mx);
+    for (size_t i = 0; i < n; i++) {
+        const char* str = text + spans[i].offset;
+        size_t len = spans[i].len;
+        if (measure_from_table(font, str, len, &tm)) {
+            out_widths[i] = tm.width;
+            continue;
+        }
+        size_t hash = key_hash(font, str, len);
+        struct measure_entry* e = lookup(font, str, len, hash);
+        if (e != NULL) {
+            cache.stats.hits++;
+            lru_unlink(e);
+            lru_push_newest(e);
+            out_widths[i] = e->tm.width;
+        } else {
+            cache.stats.misses++;
+            hashes[n_misses] = hash;
+            miss_idxs[n_misses++] = i;
+        }
+    }
+    pthread_mutex_unlock(&cache.mx);
+
+    if (n_misses > 0) {
+        for (size_t j = 0; j < n_misses; j++) {
+            miss_spans[j] = spans[miss_idxs[j]];
+        }
+        ax__measure_text_batch(font, text, miss_spans, n_misses, miss_widths);
+
+        const struct ax_font_metrics* fm = ax__font_metrics(font);
+        tm.text_height = fm->text_height;
+        tm.line_spacing = fm->line_spacing;
+        pthread_mutex_lock(&cache.mx);
+        for (size_t j = 0; j < n_misses; j++) {
+            tm.width = out_widths[miss_idxs[j]] = miss_widths[j];
+            insert(font, text + miss_spans[j].offset, miss_spans[j].len, hashes[j], &tm);
+        }
+        pthread_mutex_unlock(&cache.mx);
+    }
+}
+
+void ax__measure_text_batch_cached(struct ax_font* font,
+                                   const char* text,
+                                   const struct ax_text_span* spans,
+                                   size_t n,
+                                   ax_length* out_widths)
+{
+    for (size_t i = 0; i < n; i += AX_MEASURE_BATCH_CHUNK) {
+        size_t len = n - i < AX_MEASURE_BATCH_CHUNK ? n - i : AX_MEASURE_BATCH_CHUNK;
+        measure_chunk(font, text, spans + i, len, out_widths + i);
+    }
+}
+
+void ax__measure_cache_forget_font(struct ax_font* font)
+{
+    pthread_mutex_lock(&cache.mx);
+    struct measure_entry* e = cache.oldest;
+    while (e != NULL) {
+        struct measure_entry* newer = e->newer;
+        if (e->font == font) {
+            remove_entry(e);
+        }
+        e = newer;
+    }
+    pthread_mutex_unlock(&cache.mx);
+}
+
+void ax__measure_cache_stats(struct ax_measure_cache_stats* out_stats)
+{
+    pthread_mutex_lock(&cache.mx);
+    *out_stats = cache.stats;
+    pthread_mutex_unlock(&cache.mx);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdlib.h>
+#include "../base.h"
+
+struct ax_font;
+struct ax_text_metrics;
+struct ax_text_span;
+
+/*
+ * Bounded, process-wide cache of text measurements keyed by (font, string). Sits in
+ * front of the backend's ax__measure_text() so relayouts don't re-measure identical
+ * strings; least recently used entries are evicted once the cache is full.
+ *
+ * Strings made up only of characters in the font's advance table (see
+ * ax__font_metrics()) are measured directly from the table, and never hit the cache. So
+ * it only holds the strings that the backend has to measure: words with non-ASCII or
+ * kerned characters. Since text is measured a word at a time, that's a few thousand
+ * distinct strings even for a large document.
+ */
+
+#define AX_MEASURE_CACHE_CAPACITY 4096
+
+// batches are looked up and measured this many spans at a time, in buffers on the stack
+#define AX_MEASURE_BATCH_CHUNK 128
+
+struct ax_measure_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t n_entries;
+};
+
+void ax__measure_text_cached(struct ax_font* font,
+                             const char* text,
+                             size_t len,
+                             struct ax_text_metrics* out_metrics);
+
+// measures 'n' spans of 'text'. for each AX_MEASURE_BATCH_CHUNK spans, the cache lock is
+// only taken twice, and the misses are sent to the backend in one batch.
+void ax__measure_text_batch_cached(struct ax_font* font,
+                                   const char* text,
+                                   const struct ax_text_span* spans,
+                                   size_t n,
+                                   ax_length* out_widths);
+
+// must be called before a font is destroyed, since its address may be reused
+void ax__measure_cache_forget_font(struct ax_font* font);
+
+void ax__measure_cache_stats(struct ax_measure_cache_stats* out_stats);
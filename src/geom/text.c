@@ -3,50 +3,69 @@
 #include <ctype.h>
 
 #include "text.h"
+#include "measure.h"
 #include "../backend.h"
 #include "../utils.h"
-#include "../core/region.h"
 
-static ax_length dummy_measure_fn(const char* str, void* ud)
+static ax_length dummy_measure_fn(const char* str, size_t len, void* ud)
 {
     (void) ud;
     (void) str;
+    (void) len;
     return 0.0;
 }
 
-static ax_length font_measure_fn(const char* str, void* ud)
+static ax_length font_measure_fn(const char* str, size_t len, void* ud)
 {
     struct ax_font* font = ud;
     struct ax_text_metrics tm;
-    ax__measure_text(font, str, &tm);
+    ax__measure_text_cached(font, str, len, &tm);
     return tm.width;
 }
 
 
-void ax__text_iter_init(struct region* rgn, struct ax_text_iter* ti, const char* text)
+void ax__text_iter_init(struct ax_text_iter* ti, const char* text)
+{
+    ax__text_iter_init_len(ti, text, strlen(text));
+}
+
+void ax__text_iter_init_len(struct ax_text_iter* ti, const char* text, size_t len)
 {
-    ti->rgn = rgn;
     ti->text = text;
-    ti->word = NULL;
-    ti->line = ALLOCATES(rgn, char, strlen(text) + 1);
-    ti->line_len = 0;
-    ti->line_need_reset = false;
+    ti->len = len;
+    ti->pos = 0;
+    ti->word = (struct ax_text_span) { 0, 0 };
+    ti->line = (struct ax_text_span) { 0, 0 };
+    ti->word_width = 0.0;
+    ti->gap_width = 0.0;
+    ti->line_width = 0.0;
+    ti->line_need_reset = true;
 
     ti->mf = dummy_measure_fn;
     ti->mf_userdata = NULL;
     ti->max_width = 0.0;
+    ti->space_width = -1.0;
 }
 
 void ax__text_iter_set_font(struct ax_text_iter* ti, struct ax_font* font)
 {
     ti->mf = font_measure_fn;
     ti->mf_userdata = font;
+    ti->space_width = -1.0;
+}
+
+static inline ax_length space_width(struct ax_text_iter* ti)
+{
+    if (ti->space_width < 0.0) {
+        ti->space_width = ti->mf(" ", 1, ti->mf_userdata);
+    }
+    return ti->space_width;
 }
 
-static inline const char* beg_of_word(const char* s, bool* is_eol)
+static inline const char* beg_of_word(const char* s, const char* end, bool* is_eol)
 {
     char c;
-    while (c = s[0], isspace(c)) {
+    while (s < end && (c = s[0], isspace(c))) {
         s++;
         if (c == '\n') {
             *is_eol = true;
@@ -57,52 +76,138 @@ static inline const char* beg_of_word(const char* s, bool* is_eol)
     return s;
 }
 
-static inline const char* end_of_word(const char* s)
+static inline const char* end_of_word(const char* s, const char* end)
 {
-    while (s[0] && !isspace(s[0])) { s++; }
+    while (s < end && !isspace(s[0])) { s++; }
     return s;
 }
 
 enum ax_text_elem ax__text_iter_next(struct ax_text_iter* ti)
 {
+    const char* sow = ti->text + ti->pos;
+    bool is_eol;
+    const char* end = ti->text + ti->len;
+    const char* bow = beg_of_word(sow, end, &is_eol);
+    const char* eow = end_of_word(bow, end);
+
     if (ti->line_need_reset) {
-        ti->line[ti->line_len = 0] = '\0';
+        ti->line = (struct ax_text_span) { bow - ti->text, 0 };
+        ti->line_width = 0.0;
         ti->line_need_reset = false;
     }
 
-    bool is_eol;
-    const char* bow = beg_of_word(ti->text, &is_eol);
-    const char* eow = end_of_word(bow);
     if (is_eol) {
-        ti->text = bow;
+        ti->pos = bow - ti->text;
         ti->line_need_reset = true;
         return AX_TEXT_EOL;
     } else if (bow >= eow) {
         return AX_TEXT_END;
     } else {
+        ti->word = (struct ax_text_span) { bow - ti->text, eow - bow };
 
-        size_t w_len = eow - bow;
-        ti->word = ALLOCATES(ti->rgn, char, w_len + 1);
-        memcpy(ti->word, bow, w_len);
-        ti->word[w_len] = '\0';
+        // measure only the new word, so that wrapping is linear in the length of the
+        // text rather than quadratic. (like wrapping in the layout, this ignores kerning
+        // across the space.)
+        const char* line_start = ti->text + ti->line.offset;
+        bool first_word = ti->line.len == 0;
+        ax_length word_width = ti->mf(bow, eow - bow, ti->mf_userdata);
+        ax_length gap_width = first_word ? 0.0 : space_width(ti);
+        ax_length width = ti->line_width + gap_width + word_width;
+        ti->word_width = word_width;
+        ti->gap_width = gap_width;
 
-        size_t prev_line_len = ti->line_len;
-        if (ti->line_len > 0) {
-            ti->line[ti->line_len++] = ' ';
-        }
-        strcpy(&ti->line[ti->line_len], ti->word);
-        ti->line_len += w_len;
-
-        ax_length width = ti->mf(ti->line, ti->mf_userdata);
-        if (prev_line_len > 0 &&  // overflowing max_width is OK for first word
-            width > ti->max_width)
-        {
-            ti->line[ti->line_len = prev_line_len] = '\0';
+        // (overflowing max_width is OK for first word)
+        if (!first_word && width > ti->max_width) {
             ti->line_need_reset = true;
             return AX_TEXT_EOL;
         }
 
-        ti->text = eow;
+        ti->line.len = eow - line_start;
+        ti->line_width = width;
+        ti->pos = eow - ti->text;
         return AX_TEXT_WORD;
     }
 }
+
+static void measure_words(const char* text,
+                          struct ax_font* font,
+                          struct ax_text_word* words,
+                          size_t n)
+{
+    // the words are measured in batches, as many at a time as the cache measures at once
+    struct ax_text_span spans[AX_MEASURE_BATCH_CHUNK];
+    ax_length widths[AX_MEASURE_BATCH_CHUNK];
+    struct ax_text_metrics tm;
+    ax__measure_text_cached(font, " ", 1, &tm);
+    for (size_t first = 0; first < n; first += AX_MEASURE_BATCH_CHUNK) {
+        size_t len = n - first < AX_MEASURE_BATCH_CHUNK ? n - first : AX_MEASURE_BATCH_CHUNK;
+        for (size_t i = 0; i < len; i++) {
+            const struct ax_text_word* w = &words[first + i];
+            spans[i] = (struct ax_text_span) { w->offset, w->len };
+        }
+        ax__measure_text_batch_cached(font, text, spans, len, widths);
+        for (size_t i = 0; i < len; i++) {
+            struct ax_text_word* w = &words[first + i];
+            bool gap = first + i > 0 && w->newlines == 0 && w->len > 0;
+            w->width = widths[i];
+            w->gap_width = gap ? tm.width : 0.0;
+        }
+    }
+}
+
+size_t ax__text_segment(const char* text,
+                        size_t len,
+                        struct ax_font* font,
+                        struct ax_text_word* out_words)
+{
+    // (the iterator is only used to find words here, not to measure them)
+    struct ax_text_iter ti;
+    ax__text_iter_init_len(&ti, text, len);
+    ti.max_width = AX_LENGTH_MAX;
+
+    size_t n = 0, newlines = 0;
+    enum ax_text_elem te;
+    do {
+        te = ax__text_iter_next(&ti);
+        switch (te) {
+        case AX_TEXT_WORD:
+        case AX_TEXT_END:
+            if (out_words != NULL) {
+                bool end = te == AX_TEXT_END;
+                out_words[n] = (struct ax_text_word) {
+                    .offset = end ? ti.pos : ti.word.offset,
+                    .len = end ? 0 : ti.word.len,
+                    .newlines = newlines,
+                };
+            }
+            n++;
+            newlines = 0;
+            break;
+
+        case AX_TEXT_EOL:
+            newlines++;
+            break;
+
+        default: NO_SUCH_TAG("ax_text_elem");
+        }
+    } while (te != AX_TEXT_END);
+
+    if (out_words != NULL) {
+        measure_words(text, font, out_words, n);
+    }
+    return n;
+}
+
+size_t ax__text_line_copy(const char* line, size_t len, char* out)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; ) {
+        if (isspace(line[i])) {
+            out[n++] = ' ';
+            while (i < len && isspace(line[i])) { i++; }
+        } else {
+            out[n++] = line[i++];
+        }
+    }
+    return n;
+}
@@ -1,22 +1,31 @@
 #pragma once
 #include "../base.h"
 
-struct region;
 struct ax_font;
 
-typedef ax_length (*ax_text_measure_fn)(const char*, void*);
+typedef ax_length (*ax_text_measure_fn)(const char*, size_t, void*);
+
+// a range of bytes in the text being iterated over
+struct ax_text_span {
+    size_t offset;
+    size_t len;
+};
 
 struct ax_text_iter {
-    struct region* rgn;
     const char* text;
-    char* word;
-    char* line;
-    size_t line_len;
+    size_t len;
+    size_t pos;
+    struct ax_text_span word;
+    struct ax_text_span line;
+    ax_length word_width;
+    ax_length gap_width;
+    ax_length line_width;
     bool line_need_reset;
 
     ax_text_measure_fn mf;
     void* mf_userdata;
     ax_length max_width;
+    ax_length space_width; // (measured lazily; negative until then)
 };
 
 enum ax_text_elem {
@@ -32,7 +41,39 @@ struct ax_text_metrics {
     ax_length line_spacing;
 };
 
-void ax__text_iter_init(struct region* rgn, struct ax_text_iter* ti, const char* text);
+// a word in segmented text. the last word of every segmentation is an empty one at the
+// end of the text, so that newlines after the last real word are accounted for.
+struct ax_text_word {
+    size_t offset;
+    size_t len;
+    size_t newlines; // number of line breaks ('\n') before the word
+    ax_length width;
+    ax_length gap_width; // width of the space between the word and the previous
+};
+
+void ax__text_iter_init(struct ax_text_iter* ti, const char* text);
+// for text that isn't null terminated
+void ax__text_iter_init_len(struct ax_text_iter* ti, const char* text, size_t len);
 void ax__text_iter_set_font(struct ax_text_iter* ti, struct ax_font* font);
 
 enum ax_text_elem ax__text_iter_next(struct ax_text_iter* ti);
+
+// splits the 'len' bytes of 'text' into words and measures them. if 'out_words' is NULL,
+// just returns the number of words (including the final empty word), without measuring
+// anything.
+size_t ax__text_segment(const char* text,
+                        size_t len,
+                        struct ax_font* font,
+                        struct ax_text_word* out_words);
+
+// a line is drawn as its words with a single space between each of them, whatever the
+// whitespace between them in the text. this copies the 'len' bytes of a line from its
+// first word to its last into 'out' that way, and returns the length of the copy, which
+// is at most 'len'.
+size_t ax__text_line_copy(const char* line, size_t len, char* out);
+
+static inline
+const char* ax__text_span_str(const struct ax_text_iter* ti, struct ax_text_span sp)
+{
+    return ti->text + sp.offset;
+}
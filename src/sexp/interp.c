@@ -1,12 +1,12 @@
 #include "interp.h"
 #include "../core.h"
 #include "../tree.h"
-#include "../tree/desc.h"
 
 enum ax_interp_mode {
     M_LOG,
     M_DIE,
     M_TEXT,
+    M_TEXT_FILE,
     M_FONT,
     M_FILL,
     M_TEXT_COLOR,
@@ -18,6 +18,22 @@ enum ax_interp_mode {
     M_SELF_JUSTIFY,
     M_GROW,
     M_SHRINK,
+    M_APPEND_TEXT,
+    M_KEY,
+    M_ITEMS,
+    M_ITEM_SIZE,
+    M_FIRST_ITEM,
+    M_OVERSCAN,
+    M_PATCH,
+    M_PATCH_FILL,
+    M_PATCH_SIZE,
+    M_PATCH_GROW,
+    M_PATCH_SHRINK,
+    M_PATCH_TEXT,
+    M_PATCH_MAIN_JUSTIFY,
+    M_PATCH_CROSS_JUSTIFY,
+    M_PATCH_SELF_JUSTIFY,
+    M_PATCH_ITEMS,
     M__MAX,
 };
 
@@ -29,32 +45,45 @@ void ax__init_interp(struct ax_interp* it)
 
     it->state = 0;
     it->ctx = -1;
-    it->ctx_sp = 0;
+    ax__init_growable(&it->ctx_stack, sizeof(int) * 128);
 
-    it->desc = NULL;
-    it->parent_desc = NULL;
-    ax__init_region(&it->desc_rgn);
+    ax__init_tree(&it->tree);
+    it->node = NULL_ID;
+    ax__init_growable(&it->open_containers, sizeof(node_id) * 32);
+    ax__init_growable(&it->subtree_end, sizeof(node_id) * 256);
+    ax__init_region(&it->str_rgn);
+    it->font_name = NULL;
+    it->file_path = NULL;
+    it->file_offset = it->file_len = 0;
+
+    it->append_id = 0;
+    it->append_text = NULL;
+
+    it->patch.fields = 0;
 }
 
 void ax__free_interp(struct ax_interp* it)
 {
-    ax__free_region(&it->desc_rgn);
+    ax__free_region(&it->str_rgn);
+    ax__free_growable(&it->subtree_end);
+    ax__free_growable(&it->open_containers);
+    ax__free_tree(&it->tree);
     ax__free_region(&it->err_msg_rgn);
+    ax__free_growable(&it->ctx_stack);
 }
 
 /* static void log_stack(struct ax_interp* it)
 {
     printf("[LOG] stack: ");
-    for (size_t i = 0; i < it->ctx_sp; i++) {
-        printf("%d, ", it->ctx_stack[i]);
+    for (size_t i = 0; i < LEN(&it->ctx_stack, int); i++) {
+        printf("%d, ", ((int*) it->ctx_stack.data)[i]);
     }
     printf("%d\n", it->ctx);
 } */
 
 static void push_ctx(struct ax_interp* it, int new_ctx)
 {
-    ASSERT(it->ctx_sp < LENGTH(it->ctx_stack), "stack overflow");
-    it->ctx_stack[it->ctx_sp++] = it->ctx;
+    PUSH(&it->ctx_stack, &it->ctx);
     it->ctx = new_ctx;
     //printf("[LOG] push %d\n", new_ctx);
     //ax_interp_log_stack(it);
@@ -62,8 +91,8 @@ static void push_ctx(struct ax_interp* it, int new_ctx)
 
 static void pop_ctx(struct ax_interp* it)
 {
-    ASSERT(it->ctx_sp > 0, "stack underflow");
-    it->ctx = it->ctx_stack[--it->ctx_sp];
+    ASSERT(!ax__is_growable_empty(&it->ctx_stack), "stack underflow");
+    ax__growable_retract_into(&it->ctx_stack, sizeof(int), &it->ctx);
     //printf("[LOG] pop\n");
     //ax_interp_log_stack(it);
 }
@@ -78,86 +107,106 @@ static void end_init(struct ax_state* s, struct ax_interp* it)
     ax__initialize_backend(s);
 }
 
+static inline struct ax_node* cur_node(struct ax_interp* it)
+{
+    return ax__node_by_id(&it->tree, it->node);
+}
+
 static void begin_node(struct ax_interp* it, enum ax_node_type ty)
 {
-    struct ax_desc* desc = ALLOCATE(&it->desc_rgn, struct ax_desc);
-    // TODO: put node-default-initializing logic somewhere else?
-    desc->ty = ty;
-    switch (ty) {
-    case AX_NODE_CONTAINER:
-        desc->c = (struct ax_desc_c) {
-            .first_child = NULL,
-            .main_justify = AX_JUSTIFY_START,
-            .cross_justify = AX_JUSTIFY_START,
-            .single_line = false,
-            .background = AX_NULL_COLOR,
-        };
-        break;
-    case AX_NODE_RECTANGLE:
-        desc->r = (struct ax_rect) {
-            .fill = 0x000000,
-            .size = AX_DIM(0.0, 0.0),
-        };
-        break;
-    case AX_NODE_TEXT:
-        desc->t = (struct ax_desc_t) {
-            .color = 0x000000,
-            .font_name = "size:10",
-            .text = "blah",
-        };
-        break;
-    default: NO_SUCH_NODE_TAG();
+    // nodes are added in the order they're read, which is preorder. set_root() renumbers
+    // them once the whole tree is known.
+    it->node = ax__tree_add_node(&it->tree, ty);
+    node_id end = it->node + 1;
+    PUSH(&it->subtree_end, &end);
+    if (ty == AX_NODE_TEXT) {
+        it->font_name = "size:10";
+        it->file_path = NULL;
+        it->file_offset = it->file_len = 0;
     }
-    desc->flex_attrs = (struct ax_flex_child_attrs) {
-        .grow = 0,
-        .shrink = 1,
-        .cross_justify = AX_JUSTIFY_START,
-        .next_child = it->desc,
-    };
-    desc->parent = it->parent_desc;
-    it->desc = desc;
 }
 
-static void set_root(struct ax_state* s, struct ax_interp* it)
+static void end_text(struct ax_state* s, struct ax_interp* it)
 {
-    struct ax_backend* bac = s->backend;
     if (!ax__is_backend_initialized(s)) {
         it->err_msg = "backend not initialized";
         it->err = 1;
-        goto cleanup1;
+        return;
+    }
+    int r = 0;
+    if (it->file_path != NULL) {
+        r = ax__text_node_map_file(s, &it->tree, it->node,
+                                   it->file_path, it->file_offset, it->file_len);
+    }
+    if (r == 0) {
+        r = ax__text_node_load_font(s, s->backend, &it->tree, it->node, it->font_name);
     }
-
-    struct ax_tree tree;
-    ax__init_tree(&tree);
-    node_id root;
-    int r = ax__build_node(s, bac, &tree, it->desc, &root);
     if (r != 0) {
         it->err = r;
-        goto cleanup2;
     }
-    ax__set_tree(s, &tree);
-    ASSERT(ax__is_tree_empty(&tree), "tree should be empty now-");
-
-cleanup2:
-    ax__free_tree(&tree);
-cleanup1:
-    it->desc = NULL;
-    it->parent_desc = NULL;
-    ax__region_clear(&it->desc_rgn);
+}
+
+static void set_root(struct ax_state* s, struct ax_interp* it)
+{
+    if (!ax__is_backend_initialized(s)) {
+        it->err_msg = "backend not initialized";
+        it->err = 1;
+        goto cleanup;
+    }
+    ax__tree_finish_preorder(&it->tree, it->subtree_end.data);
+    ax__set_tree(s, &it->tree);
+    ASSERT(ax__is_tree_empty(&it->tree), "tree should be empty now-");
+
+cleanup:
+    ax__tree_clear(&it->tree);
+    it->node = NULL_ID;
+    ax__growable_clear(&it->subtree_end);
+    ax__growable_clear(&it->open_containers);
+    ax__region_clear(&it->str_rgn);
+}
+
+static void append_text(struct ax_state* s, struct ax_interp* it)
+{
+    // (only the layout thread modifies the tree, and it never changes the node types)
+    if (it->append_id >= ax__tree_count(s->tree) ||
+        ax__node_by_id(s->tree, it->append_id)->ty != AX_NODE_TEXT)
+    {
+        it->err_msg = "append-text: not a text node";
+        it->err = 1;
+        goto cleanup;
+    }
+    ax__append_text(s, it->append_id, it->append_text);
+
+cleanup:
+    it->append_text = NULL;
+    ax__region_clear(&it->str_rgn);
+}
+
+static void patch(struct ax_state* s, struct ax_interp* it)
+{
+    if (!ax__patch_applies(s->tree, &it->patch)) {
+        it->err_msg = "patch: not a node with those attributes";
+        it->err = 1;
+        goto cleanup;
+    }
+    ax__patch(s, &it->patch);
+
+cleanup:
+    it->patch.fields = 0;
+    ax__region_clear(&it->str_rgn);
 }
 
 static void begin_children(struct ax_interp* it)
 {
-    it->parent_desc = it->desc;
-    it->desc = NULL;
+    PUSH(&it->open_containers, &it->node);
 }
 
 static void end_children(struct ax_interp* it)
 {
-    struct ax_desc* parent = it->parent_desc;
-    parent->c.first_child = ax_desc_reverse_flex_children(it->desc);
-    it->parent_desc = parent->parent;
-    it->desc = parent;
+    node_id parent;
+    ax__growable_retract_into(&it->open_containers, sizeof(node_id), &parent);
+    ((node_id*) it->subtree_end.data)[parent] = ax__tree_count(&it->tree);
+    it->node = parent;
 }
 
 static void begin_win_size(struct ax_interp* it) { it->mode = M_WIN_SIZE; it->i = 0; }
@@ -171,22 +220,43 @@ static void begin_self_justify(struct ax_interp* it) { it->mode = M_SELF_JUSTIFY
 static void begin_grow(struct ax_interp* it) { it->mode = M_GROW; }
 static void begin_shrink(struct ax_interp* it) { it->mode = M_SHRINK; }
 static void begin_text(struct ax_interp* it) { it->mode = M_TEXT; }
+static void begin_text_file(struct ax_interp* it) { it->mode = M_TEXT_FILE; it->i = 0; }
 static void begin_font(struct ax_interp* it) { it->mode = M_FONT; }
 static void begin_text_color(struct ax_interp* it) { it->mode = M_TEXT_COLOR; }
 static void begin_rgb(struct ax_interp* it) { it->i = 0; }
 static void begin_background(struct ax_interp* it) { it->mode = M_BACKGROUND; }
+static void begin_append_text(struct ax_interp* it) { it->mode = M_APPEND_TEXT; }
+static void begin_key(struct ax_interp* it) { it->mode = M_KEY; }
+static void begin_items(struct ax_interp* it) { it->mode = M_ITEMS; }
+static void begin_item_size(struct ax_interp* it) { it->mode = M_ITEM_SIZE; }
+static void begin_first_item(struct ax_interp* it) { it->mode = M_FIRST_ITEM; }
+static void begin_overscan(struct ax_interp* it) { it->mode = M_OVERSCAN; }
+static void begin_patch(struct ax_interp* it) { it->mode = M_PATCH; }
+static void begin_patch_fill(struct ax_interp* it) { it->mode = M_PATCH_FILL; }
+static void begin_patch_size(struct ax_interp* it) { it->mode = M_PATCH_SIZE; it->i = 0; }
+static void begin_patch_grow(struct ax_interp* it) { it->mode = M_PATCH_GROW; }
+static void begin_patch_shrink(struct ax_interp* it) { it->mode = M_PATCH_SHRINK; }
+static void begin_patch_text(struct ax_interp* it) { it->mode = M_PATCH_TEXT; }
+static void begin_patch_main_justify(struct ax_interp* it) { it->mode = M_PATCH_MAIN_JUSTIFY; }
+static void begin_patch_cross_justify(struct ax_interp* it) { it->mode = M_PATCH_CROSS_JUSTIFY; }
+static void begin_patch_self_justify(struct ax_interp* it) { it->mode = M_PATCH_SELF_JUSTIFY; }
+static void begin_patch_items(struct ax_interp* it) { it->mode = M_PATCH_ITEMS; }
 
 static void color(struct ax_interp* it, ax_color col)
 {
     switch (it->mode) {
     case M_FILL:
-        it->desc->r.fill = col;
+        cur_node(it)->r.fill = col;
         break;
     case M_TEXT_COLOR:
-        it->desc->t.color = col;
+        cur_node(it)->t.color = col;
         break;
     case M_BACKGROUND:
-        it->desc->c.background = col;
+        cur_node(it)->c.background = col;
+        break;
+    case M_PATCH_FILL:
+        it->patch.fill = col;
+        it->patch.fields |= AX_PATCH_FILL;
         break;
     default: break;
     }
@@ -205,14 +275,25 @@ static void string(struct ax_state* s, struct ax_interp* it, const char* str)
         it->err = 1;
         break;
     case M_TEXT:
-        it->desc->t.text = ax__strdup(&it->desc_rgn, str);
+        ax__text_node_set_string(&it->tree, it->node, str);
+        break;
+    case M_TEXT_FILE:
+        it->file_path = ax__strdup(&it->str_rgn, str);
         break;
     case M_FONT:
-        it->desc->t.font_name = ax__strdup(&it->desc_rgn, str);
+        it->font_name = ax__strdup(&it->str_rgn, str);
+        break;
+    case M_APPEND_TEXT:
+        it->append_text = ax__strdup(&it->str_rgn, str);
+        break;
+    case M_PATCH_TEXT:
+        it->patch.text = ax__strdup(&it->str_rgn, str);
+        it->patch.fields |= AX_PATCH_TEXT;
         break;
     case M_FILL:
     case M_TEXT_COLOR:
-    case M_BACKGROUND: {
+    case M_BACKGROUND:
+    case M_PATCH_FILL: {
         ax_color col = strtol(str, NULL, 16);
         color(it, col);
         break;
@@ -228,7 +309,11 @@ static void dim(struct ax_state* s, struct ax_interp* it, struct ax_dim d)
         ax__config_win_size(s, d);
         break;
     case M_RECT_SIZE:
-        it->desc->r.size = d;
+        cur_node(it)->r.size = d;
+        break;
+    case M_PATCH_SIZE:
+        it->patch.size = d;
+        it->patch.fields |= AX_PATCH_SIZE;
         break;
     default: break;
     }
@@ -240,12 +325,13 @@ static void integer(struct ax_state* s, struct ax_interp* it, long v)
 
     case M_WIN_SIZE:
     case M_RECT_SIZE:
+    case M_PATCH_SIZE:
         switch (it->i++) {
         case 0:
-            it->dim.w = v;
+            it->dim.w = AX_LENGTH(v);
             break;
         case 1:
-            it->dim.h = v;
+            it->dim.h = AX_LENGTH(v);
             dim(s, it, it->dim);
             break;
         default: break;
@@ -253,15 +339,59 @@ static void integer(struct ax_state* s, struct ax_interp* it, long v)
         break;
 
     case M_GROW:
-        it->desc->flex_attrs.grow = v;
+        cur_node(it)->grow_factor = v;
         break;
     case M_SHRINK:
-        it->desc->flex_attrs.shrink = v;
+        cur_node(it)->shrink_factor = v;
+        break;
+    case M_KEY:
+        cur_node(it)->key = v;
+        break;
+    case M_ITEMS:
+        cur_node(it)->l.n_items = v < 0 ? 0 : v;
+        break;
+    case M_ITEM_SIZE:
+        cur_node(it)->l.item_size = AX_LENGTH(v < 0 ? 0 : v);
+        break;
+    case M_FIRST_ITEM:
+        cur_node(it)->l.first_item = v < 0 ? 0 : v;
+        break;
+    case M_OVERSCAN:
+        cur_node(it)->l.overscan = v < 0 ? 0 : v;
+        break;
+
+    case M_PATCH:
+        it->patch.id = v < 0 || v >= NULL_ID ? NULL_ID : (node_id) v;
+        break;
+    case M_PATCH_GROW:
+        it->patch.grow_factor = v;
+        it->patch.fields |= AX_PATCH_GROW;
+        break;
+    case M_PATCH_SHRINK:
+        it->patch.shrink_factor = v;
+        it->patch.fields |= AX_PATCH_SHRINK;
+        break;
+    case M_PATCH_ITEMS:
+        it->patch.n_items = v < 0 ? 0 : v;
+        it->patch.fields |= AX_PATCH_ITEMS;
+        break;
+
+    case M_APPEND_TEXT:
+        it->append_id = v < 0 ? SIZE_MAX : (size_t) v;
+        break;
+
+    case M_TEXT_FILE:
+        if (it->i++ == 0) {
+            it->file_offset = v < 0 ? 0 : v;
+        } else {
+            it->file_len = v < 0 ? 0 : v;
+        }
         break;
 
     case M_FILL:
     case M_TEXT_COLOR:
     case M_BACKGROUND:
+    case M_PATCH_FILL:
         // (rgb ...) form
         it->rgb[it->i++] = v < 0 ? 0 : v > 255 ? 255 : v;
         if (it->i >= 3) {
@@ -277,13 +407,25 @@ static void justify(struct ax_interp* it, enum ax_justify just)
 {
     switch (it->mode) {
     case M_MAIN_JUSTIFY:
-        it->desc->c.main_justify = just;
+        cur_node(it)->c.main_justify = just;
         break;
     case M_CROSS_JUSTIFY:
-        it->desc->c.cross_justify = just;
+        cur_node(it)->c.cross_justify = just;
         break;
     case M_SELF_JUSTIFY:
-        it->desc->flex_attrs.cross_justify = just;
+        cur_node(it)->cross_justify = just;
+        break;
+    case M_PATCH_MAIN_JUSTIFY:
+        it->patch.main_justify = just;
+        it->patch.fields |= AX_PATCH_MAIN_JUSTIFY;
+        break;
+    case M_PATCH_CROSS_JUSTIFY:
+        it->patch.cross_justify = just;
+        it->patch.fields |= AX_PATCH_CROSS_JUSTIFY;
+        break;
+    case M_PATCH_SELF_JUSTIFY:
+        it->patch.self_justify = just;
+        it->patch.fields |= AX_PATCH_SELF_JUSTIFY;
         break;
     default: break;
     }
@@ -291,7 +433,7 @@ static void justify(struct ax_interp* it, enum ax_justify just)
 
 static void cont_set_single_line(struct ax_interp* it, bool s)
 {
-    it->desc->c.single_line = s;
+    cur_node(it)->c.single_line = s;
 }
 
 void ax__interp(struct ax_state* s,
@@ -2,9 +2,10 @@
 #include "../base.h"
 #include "../sexp.h"
 #include "../core/region.h"
+#include "../core/growable.h"
+#include "../tree.h"
 
 struct ax_state;
-struct ax_desc;
 
 struct ax_interp {
     int err;
@@ -14,13 +15,26 @@ struct ax_interp {
     // for sexp lexer
     int state;
     int ctx;
-    int ctx_stack[128];
-    size_t ctx_sp;
+    struct growable ctx_stack; // (of int; grows with the nesting depth)
 
-    // for building nodes
-    struct ax_desc* desc;
-    struct ax_desc* parent_desc;
-    struct region desc_rgn;
+    // for building trees. the nodes of 'tree' are in preorder until set-root
+    struct ax_tree tree;
+    node_id node;                    // (the node being read)
+    struct growable open_containers; // (of node_id)
+    struct growable subtree_end;     // (of node_id; see ax__tree_finish_preorder())
+    struct region str_rgn;           // (for strings that aren't kept in the tree)
+
+    // for the text node being read
+    const char* font_name;
+    const char* file_path;
+    size_t file_offset, file_len;
+
+    // for appending text
+    size_t append_id;
+    const char* append_text;
+
+    // for patching nodes
+    struct ax_patch patch;
 
     // for parsing primitive types
     int mode;
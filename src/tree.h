@@ -6,15 +6,16 @@
 
 struct ax_state;
 struct ax_backend;
-struct ax_desc;
 struct ax_font;
+struct ax_text_word;
 
-typedef size_t node_id;
+typedef uint32_t node_id;
 
 enum ax_node_type {
     AX_NODE_CONTAINER = 0,
     AX_NODE_RECTANGLE,
     AX_NODE_TEXT,
+    AX_NODE_LIST,
     AX_NODE__MAX
 };
 
@@ -29,6 +30,7 @@ enum ax_justify {
 };
 
 struct ax_node_c {
+    // (line_count points into the tree's 'line_count' array)
     size_t n_lines;
     size_t* line_count;
     enum ax_justify main_justify;
@@ -45,19 +47,72 @@ struct ax_rect {
 struct ax_node_t {
     ax_color color;
     char* text;
+    size_t text_len, text_cap;
     struct ax_font* font;
+
+    // the mapping that 'text' points into, if it comes from a file. (in that case the
+    // text is read-only, and 'text_cap' is 0 so that appending makes a copy)
+    void* map;
+    size_t map_len;
+
+    // the malloc'd buffer that 'text' is in, if it was patched. (like mappings, these
+    // can only be freed once no draw buffer that is drawn points into them.)
+    char* patched_text;
+    // the tree's 'text_gen' when 'patched_text' was allocated
+    size_t patched_gen;
+
+    // words in the text, with their widths. computed when the node is built, and then
+    // only for the end of the text when it is appended to.
+    size_t n_words, words_cap;
+    struct ax_text_word* words;
+    uint64_t text_hash; // (ax__hash_bytes() of the text)
+
+    // lines from the last time the text was wrapped, the width that it was wrapped at,
+    // and how many of the words those lines are still valid for. these are kept between
+    // layouts, so that appending only needs to re-wrap the last paragraph.
+    ax_length wrap_width;
+    size_t n_wrapped_words;
+    struct growable line_buf;
+    size_t n_lines;
     struct ax_node_t_line* lines;
+
+    // the node was outside the window when it was placed, so its lines weren't wrapped
+    // at the target width, and don't have coordinates
+    bool culled;
+};
+
+// the rows of the window (and this many more on either side of it) are requested, unless
+// the list sets its own 'overscan'
+#define AX_LIST_DEFAULT_OVERSCAN 4
+
+// a list of 'n_items' rows, stacked downwards, which are each as wide as the list and
+// 'item_size' high. only the rows of the items [first_item, first_item + n_children)
+// exist, as its children; rows that come into the window (give or take 'overscan' rows)
+// but don't exist yet are requested from the client, with an AX_EVENT_ROWS event. so a
+// list costs the same to lay out and draw however many items it has.
+struct ax_node_l {
+    size_t n_items;
+    ax_length item_size;
+    size_t first_item;
+    size_t overscan;
+
+    // the rows that were requested last, so that the same ones aren't requested on
+    // every layout until the client gives them
+    size_t req_first, req_count;
 };
 
 struct ax_node_t_line {
-    struct ax_node_t_line* next;
+    // range of 'text' on this line
+    size_t offset;
+    size_t len;
+    ax_length width;
     struct ax_pos coord;
-    char* str;
 };
 
 struct ax_node {
     // properties
     enum ax_node_type ty;
+    int64_t key; // (AX_NO_KEY if the node has none)
     uint32_t grow_factor;
     uint32_t shrink_factor;
     enum ax_justify cross_justify;
@@ -65,25 +120,55 @@ struct ax_node {
         struct ax_node_c c;
         struct ax_rect r;
         struct ax_node_t t;
+        struct ax_node_l l;
     };
 
-    // geometry computations
-    struct ax_dim avail; // TODO: infinite avail size
-    struct ax_dim hypoth;
-    struct ax_dim target;
-    struct ax_pos coord;
-
-    // intrusive linked list
-    node_id first_child_id;
-    node_id next_node_id;
 };
 
+// nodes are stored as parallel arrays indexed by id, so that the layout passes only pull
+// the fields they use into cache. 'nodes' holds the properties; the topology and the
+// geometry computed by ax__layout() are in arrays of their own.
+//
+// ids are handed out breadth-first, so every node comes after its parent and the
+// children of a node are the contiguous ids [first_child, first_child + n_children).
 struct ax_tree {
     struct region rgn;
-    struct growable nodes;
+    size_t count, cap;
+    struct ax_node* nodes;
+    node_id* first_child;
+    node_id* n_children;
+    node_id* parent;
+    struct ax_dim* avail; // TODO: infinite avail size
+    struct ax_dim* hypoth;
+    struct ax_dim* target;
+    struct ax_pos* coord;
+
+    // bounds of everything drawn by the subtree, which can be more than the node's own
+    // bounds when its children overflow. used to skip subtrees outside the window.
+    struct ax_aabb* extent;
+
+    // the line counts of a container are stored at the ids of its children, since it
+    // never has more lines than children.
+    size_t* line_count;
+
+    // hash of everything that the layout of a subtree depends on, so that identical
+    // subtrees can share their results. ax__layout() computes it for dirty nodes.
+    uint64_t* hash;
+
+    // a node is dirty if its geometry is out of date. the ancestors of a dirty node are
+    // always dirty too, and ax__layout() leaves every node clean.
+    bool* dirty;
+
+    // text buffers that nodes no longer use, but that the draw buffers may still point
+    // into (of struct ax_text_buf)
+    struct growable dead_text;
+    // counts the times the dead text was taken. (no draw buffer points into text that was
+    // patched in since, so it can be overwritten.)
+    size_t text_gen;
 };
 
-#define NULL_ID             SIZE_MAX
+#define NULL_ID             UINT32_MAX
+#define AX_NO_KEY           INT64_MIN
 #define ID_IS_NULL(_id)     ((_id) == NULL_ID)
 #define NO_SUCH_NODE_TAG()  NO_SUCH_TAG("ax_node_type")
 
@@ -93,11 +178,101 @@ void ax__tree_clear(struct ax_tree* tr);
 
 void ax__free_node(struct ax_node* node);
 
-int ax__build_node(struct ax_state* s,     // used for ax__set_error()
-                   struct ax_backend* bac, // used to load fonts
-                   struct ax_tree* tr,
-                   const struct ax_desc* desc,
-                   node_id* out_id);
+// a buffer that the text of a text node points into: a mapping of part of a file, or
+// (if 'map_len' is 0) text from a patch, which is freed
+struct ax_text_buf {
+    void* ptr;
+    size_t map_len;
+};
+
+// moves the tree's dead text, and the mappings and patched text of its text nodes, into
+// 'bufs' (of struct ax_text_buf), so that they aren't released along with the nodes. (the
+// draw buffers point into the text, so it has to stay around until no buffer that is
+// drawn points into it anymore.)
+void ax__tree_take_text_bufs(struct ax_tree* tr, struct growable* bufs);
+
+// moves only the tree's dead text into 'bufs'.
+void ax__tree_take_dead_text(struct ax_tree* tr, struct growable* bufs);
+
+// unmaps or frees everything in 'bufs' (of struct ax_text_buf), and clears it.
+void ax__release_text_bufs(struct growable* bufs);
+
+// adds a node with default properties. a tree is built by adding its nodes in preorder
+// (each node followed by all of its descendants), and then calling
+// ax__tree_finish_preorder(); until then the topology isn't valid.
+node_id ax__tree_add_node(struct ax_tree* tr, enum ax_node_type ty);
+
+// renumbers the nodes added by ax__tree_add_node() breadth-first, and sets up the
+// children of each node. 'subtree_end[id]' is one past the last descendant of 'id'.
+void ax__tree_finish_preorder(struct ax_tree* tr, const node_id* subtree_end);
+
+// the text of a text node is either a copy of 'str', or a range of a file which is
+// mapped rather than copied.
+void ax__text_node_set_string(struct ax_tree* tr, node_id id, const char* str);
+int ax__text_node_map_file(struct ax_state* s, // used for ax__set_error()
+                           struct ax_tree* tr,
+                           node_id id,
+                           const char* path,
+                           size_t offset,
+                           size_t len);
+
+int ax__text_node_load_font(struct ax_state* s,     // used for ax__set_error()
+                            struct ax_backend* bac, // used to load fonts
+                            struct ax_tree* tr,
+                            node_id id,
+                            const char* font_name);
+
+// splits the text of a text node into words, and measures them. the text and font must
+// be set already.
+void ax__text_node_segment(struct ax_tree* tr, node_id id);
+
+// prepares the new tree 'tr' to replace 'prev'. the subtrees of 'tr' whose root has a
+// key, and which are identical to the subtree in 'prev' with the same key, take over
+// its segmented text and geometry, and are left clean. the rest of 'tr' is segmented
+// and left dirty.
+void ax__tree_reconcile(struct ax_tree* tr, struct ax_tree* prev);
+
+// marks the node and all of its ancestors dirty.
+void ax__tree_mark_dirty(struct ax_tree* tr, node_id id);
+
+// changes to the properties of a single node, made in place. 'fields' says which of the
+// properties are set.
+enum ax_patch_field {
+    AX_PATCH_FILL          = 1 << 0,
+    AX_PATCH_SIZE          = 1 << 1,
+    AX_PATCH_GROW          = 1 << 2,
+    AX_PATCH_SHRINK        = 1 << 3,
+    AX_PATCH_TEXT          = 1 << 4,
+    AX_PATCH_MAIN_JUSTIFY  = 1 << 5,
+    AX_PATCH_CROSS_JUSTIFY = 1 << 6,
+    AX_PATCH_SELF_JUSTIFY  = 1 << 7,
+    AX_PATCH_ITEMS         = 1 << 8,
+};
+
+struct ax_patch {
+    node_id id;
+    int fields;
+    ax_color fill;
+    struct ax_dim size;
+    uint32_t grow_factor;
+    uint32_t shrink_factor;
+    const char* text;
+    enum ax_justify main_justify;
+    enum ax_justify cross_justify;
+    enum ax_justify self_justify;
+    size_t n_items;
+};
+
+// whether the node exists, and every field of the patch applies to its type.
+bool ax__patch_applies(struct ax_tree* tr, const struct ax_patch* patch);
+
+// applies the patch, and marks the node dirty if its geometry may change. 'text' is
+// copied, and the node's old text is moved to the tree's dead text.
+void ax__tree_patch(struct ax_tree* tr, const struct ax_patch* patch);
+
+// appends 'text' to the text node 'id'. only the end of the text is re-segmented, and
+// only its last paragraph is re-wrapped by the next layout.
+void ax__text_append(struct ax_tree* tr, node_id id, const char* text);
 
 static inline
 void ax__tree_drain_from(struct ax_tree* tr,
@@ -112,41 +287,42 @@ void ax__tree_drain_from(struct ax_tree* tr,
 static inline
 bool ax__is_tree_empty(struct ax_tree* tree)
 {
-    return ax__is_growable_empty(&tree->nodes);
+    return tree->count == 0;
 }
 
 static inline
 size_t ax__tree_count(struct ax_tree* tree)
 {
-    return LEN(&tree->nodes, struct ax_node);
+    return tree->count;
 }
 
 static inline
 struct ax_node* ax__node_by_id(struct ax_tree* tree, node_id id)
 {
-    struct ax_node* nodes = tree->nodes.data;
-    return &nodes[id];
+    return &tree->nodes[id];
 }
 
 static inline
-struct ax_node* ax__root(struct ax_tree* tree)
+node_id ax__node_id(struct ax_tree* tree, const struct ax_node* node)
 {
-    return ax__node_by_id(tree, 0);
+    return node - tree->nodes;
 }
 
 static inline
-node_id ax__new_id(struct ax_tree* tree)
+struct ax_node* ax__root(struct ax_tree* tree)
 {
-    size_t id = ax__tree_count(tree);
-    (void) ax__growable_extend(&tree->nodes, sizeof(struct ax_node));
-    return id;
+    return ax__node_by_id(tree, 0);
 }
 
+// the new node has no children yet. this may move all of the arrays.
+node_id ax__new_id(struct ax_tree* tree);
+
 #ifdef AX_DEFINE_TRAVERSAL_MACROS
 
-#define DEFINE_TRAVERSAL_LOCALS(_t, ...)        \
-    struct ax_tree* _trav_tree = _t;            \
-    node_id _trav_id;                           \
+#define DEFINE_TRAVERSAL_LOCALS(_t, ...)                \
+    struct ax_tree* _trav_tree = _t;                    \
+    node_id _trav_id;                                   \
+    node_id _trav_end __attribute__((unused));          \
     struct ax_node* __VA_ARGS__
 
 #define FOR_EACH_FROM_TOP(_n)                               \
@@ -161,10 +337,12 @@ node_id ax__new_id(struct ax_tree* tree)
          _trav_id--)                                            \
         if ((_n = ax__node_by_id(_trav_tree, _trav_id - 1)), 1)
 
-#define FOR_EACH_CHILD(_n, _c)                              \
-    for (_trav_id = (_n)->first_child_id;                   \
-         !ID_IS_NULL(_trav_id);                             \
-         _trav_id = (_c)->next_node_id)                     \
+#define FOR_EACH_CHILD(_n, _c)                                      \
+    for (_trav_end = ax__node_id(_trav_tree, _n),                   \
+             _trav_id = _trav_tree->first_child[_trav_end],         \
+             _trav_end = _trav_id + _trav_tree->n_children[_trav_end]; \
+         _trav_id < _trav_end;                                      \
+         _trav_id++)                                                \
         if ((_c = ax__node_by_id(_trav_tree, _trav_id)), 1)
 
 #define FOR_EACH_CHILD_IN_LINES(_li, _i, _n, _c)    \
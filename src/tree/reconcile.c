@@ -0,0 +1,238 @@
+#include <string.h>
+#include "../tree.h"
+#include "../utils.h"
+#include "../geom/text.h"
+
+// open-addressed table from the keys of the previous tree to their ids. an id is set to
+// NULL_ID once its subtree is taken over, rather than removing the key, so that the
+// probe sequences of the other keys stay intact.
+struct key_table {
+    size_t cap; // (power of two)
+    int64_t* keys;
+    node_id* ids;
+};
+
+static size_t key_slot(const struct key_table* kt, int64_t key)
+{
+    size_t mask = kt->cap - 1;
+    size_t i = ax__hash_bytes((const char*) &key, sizeof(key)) & mask;
+    while (kt->keys[i] != AX_NO_KEY && kt->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void init_key_table(struct key_table* kt, struct ax_tree* prev)
+{
+    size_t n_keys = 0;
+    for (node_id id = 0; id < ax__tree_count(prev); id++) {
+        n_keys += ax__node_by_id(prev, id)->key != AX_NO_KEY;
+    }
+    kt->cap = 16;
+    while (kt->cap < n_keys * 2) {
+        kt->cap *= 2;
+    }
+    kt->keys = malloc(sizeof(int64_t) * kt->cap);
+    kt->ids = malloc(sizeof(node_id) * kt->cap);
+    for (size_t i = 0; i < kt->cap; i++) {
+        kt->keys[i] = AX_NO_KEY;
+    }
+    for (node_id id = 0; id < ax__tree_count(prev) && n_keys > 0; id++) {
+        int64_t key = ax__node_by_id(prev, id)->key;
+        if (key == AX_NO_KEY) {
+            continue;
+        }
+        // (if a key is repeated, the first node with it wins)
+        size_t i = key_slot(kt, key);
+        if (kt->keys[i] == AX_NO_KEY) {
+            kt->keys[i] = key;
+            kt->ids[i] = id;
+        }
+    }
+}
+
+static void free_key_table(struct key_table* kt)
+{
+    free(kt->ids);
+    free(kt->keys);
+}
+
+static node_id take_key(struct key_table* kt, int64_t key)
+{
+    size_t i = key_slot(kt, key);
+    if (kt->keys[i] == AX_NO_KEY) {
+        return NULL_ID;
+    }
+    node_id id = kt->ids[i];
+    kt->ids[i] = NULL_ID;
+    return id;
+}
+
+static bool same_dim(struct ax_dim a, struct ax_dim b)
+{
+    return !(a.w < b.w) && !(a.w > b.w) && !(a.h < b.h) && !(a.h > b.h);
+}
+
+// whether the nodes would be laid out the same. (colors don't matter, since the geometry
+// is moved over to the new node, which keeps its own.)
+static bool same_layout_props(const struct ax_node* a, const struct ax_node* b)
+{
+    if (a->ty != b->ty ||
+        a->key != b->key ||
+        a->grow_factor != b->grow_factor ||
+        a->shrink_factor != b->shrink_factor ||
+        a->cross_justify != b->cross_justify)
+    {
+        return false;
+    }
+    switch (a->ty) {
+
+    case AX_NODE_CONTAINER:
+        return a->c.main_justify == b->c.main_justify &&
+            a->c.cross_justify == b->c.cross_justify &&
+            a->c.single_line == b->c.single_line;
+
+    case AX_NODE_RECTANGLE:
+        return same_dim(a->r.size, b->r.size);
+
+    case AX_NODE_TEXT:
+        return a->t.font == b->t.font &&
+            a->t.text_len == b->t.text_len &&
+            memcmp(a->t.text, b->t.text, a->t.text_len) == 0;
+
+    case AX_NODE_LIST:
+        return a->l.n_items == b->l.n_items &&
+            !(a->l.item_size < b->l.item_size) && !(a->l.item_size > b->l.item_size) &&
+            a->l.first_item == b->l.first_item &&
+            a->l.overscan == b->l.overscan;
+
+    default: NO_SUCH_NODE_TAG();
+    }
+}
+
+struct node_pair {
+    node_id id;
+    node_id prev_id;
+};
+
+// compares the layout of the subtree 'id' with the subtree 'prev_id' of 'prev'. if they
+// are the same, 'pairs' is left holding every pair of corresponding nodes.
+static bool same_subtree(struct growable* pairs,
+                         struct ax_tree* tr, node_id id,
+                         struct ax_tree* prev, node_id prev_id)
+{
+    if (prev->dirty[prev_id]) {
+        // (never laid out, or already taken over)
+        return false;
+    }
+    ax__growable_clear(pairs);
+    struct node_pair pair = { id, prev_id };
+    PUSH(pairs, &pair);
+    for (size_t i = 0; i < LEN(pairs, struct node_pair); i++) {
+        pair = ((struct node_pair*) pairs->data)[i];
+        if (tr->n_children[pair.id] != prev->n_children[pair.prev_id] ||
+            !same_layout_props(ax__node_by_id(tr, pair.id),
+                               ax__node_by_id(prev, pair.prev_id)))
+        {
+            return false;
+        }
+        for (node_id k = 0; k < tr->n_children[pair.id]; k++) {
+            struct node_pair child = {
+                tr->first_child[pair.id] + k,
+                prev->first_child[pair.prev_id] + k,
+            };
+            PUSH(pairs, &child);
+        }
+    }
+    return true;
+}
+
+// moves the segmentation and geometry of a node over from the previous tree.
+static void take_over(struct ax_tree* tr, node_id id,
+                      struct ax_tree* prev, node_id prev_id)
+{
+    struct ax_node* node = ax__node_by_id(tr, id);
+    struct ax_node* prev_node = ax__node_by_id(prev, prev_id);
+    tr->avail[id] = prev->avail[prev_id];
+    tr->hypoth[id] = prev->hypoth[prev_id];
+    tr->target[id] = prev->target[prev_id];
+    tr->coord[id] = prev->coord[prev_id];
+    tr->extent[id] = prev->extent[prev_id];
+    tr->hash[id] = prev->hash[prev_id];
+    tr->dirty[id] = false;
+    prev->dirty[prev_id] = true;
+    switch (node->ty) {
+
+    case AX_NODE_CONTAINER: {
+        size_t n_lines = prev_node->c.n_lines;
+        node->c.n_lines = n_lines;
+        node->c.line_count = NULL;
+        if (n_lines > 0) {
+            node->c.line_count = &tr->line_count[tr->first_child[id]];
+            memcpy(node->c.line_count, prev_node->c.line_count, sizeof(size_t) * n_lines);
+        }
+        break;
+    }
+
+    case AX_NODE_RECTANGLE:
+        break;
+
+    case AX_NODE_TEXT: {
+        struct ax_node_t* t = &node->t;
+        struct ax_node_t* prev_t = &prev_node->t;
+        // (the words are in the previous tree's region, which is about to be cleared)
+        t->n_words = t->words_cap = prev_t->n_words;
+        t->words = ALLOCATES(&tr->rgn, struct ax_text_word, t->n_words);
+        memcpy(t->words, prev_t->words, sizeof(struct ax_text_word) * t->n_words);
+        t->text_hash = prev_t->text_hash;
+        struct growable tmp = t->line_buf;
+        t->line_buf = prev_t->line_buf;
+        prev_t->line_buf = tmp;
+        t->lines = prev_t->lines;
+        t->n_lines = prev_t->n_lines;
+        t->wrap_width = prev_t->wrap_width;
+        t->n_wrapped_words = prev_t->n_wrapped_words;
+        t->culled = prev_t->culled;
+        prev_t->lines = NULL;
+        prev_t->n_lines = 0;
+        break;
+    }
+
+    case AX_NODE_LIST:
+        node->l.req_first = prev_node->l.req_first;
+        node->l.req_count = prev_node->l.req_count;
+        break;
+
+    default: NO_SUCH_NODE_TAG();
+    }
+}
+
+void ax__tree_reconcile(struct ax_tree* tr, struct ax_tree* prev)
+{
+    struct key_table kt;
+    init_key_table(&kt, prev);
+    struct growable pairs;
+    ax__init_growable(&pairs, sizeof(struct node_pair) * 64);
+
+    for (node_id id = 0; id < ax__tree_count(tr); id++) {
+        if (!tr->dirty[id]) {
+            // (in a subtree that was already taken over)
+            continue;
+        }
+        struct ax_node* node = ax__node_by_id(tr, id);
+        node_id prev_id = node->key == AX_NO_KEY ? NULL_ID : take_key(&kt, node->key);
+        if (!ID_IS_NULL(prev_id) && same_subtree(&pairs, tr, id, prev, prev_id)) {
+            const struct node_pair* p = pairs.data;
+            for (size_t i = 0; i < LEN(&pairs, struct node_pair); i++) {
+                take_over(tr, p[i].id, prev, p[i].prev_id);
+            }
+            continue;
+        }
+        if (node->ty == AX_NODE_TEXT) {
+            ax__text_node_segment(tr, id);
+        }
+    }
+
+    ax__free_growable(&pairs);
+    free_key_table(&kt);
+}
@@ -1,31 +1,94 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define AX_DEFINE_TRAVERSAL_MACROS 1
 #include "../tree.h"
-#include "../tree/desc.h"
+#include "../core.h"
 #include "../utils.h"
 #include "../backend.h"
+#include "../geom/font.h"
+#include "../geom/text.h"
+
+static void resize_tree_arrays(struct ax_tree* tr, size_t cap)
+{
+    tr->cap = cap;
+    tr->nodes = realloc(tr->nodes, sizeof(struct ax_node) * cap);
+    tr->first_child = realloc(tr->first_child, sizeof(node_id) * cap);
+    tr->n_children = realloc(tr->n_children, sizeof(node_id) * cap);
+    tr->parent = realloc(tr->parent, sizeof(node_id) * cap);
+    tr->avail = realloc(tr->avail, sizeof(struct ax_dim) * cap);
+    tr->hypoth = realloc(tr->hypoth, sizeof(struct ax_dim) * cap);
+    tr->target = realloc(tr->target, sizeof(struct ax_dim) * cap);
+    tr->coord = realloc(tr->coord, sizeof(struct ax_pos) * cap);
+    tr->extent = realloc(tr->extent, sizeof(struct ax_aabb) * cap);
+    tr->line_count = realloc(tr->line_count, sizeof(size_t) * cap);
+    tr->hash = realloc(tr->hash, sizeof(uint64_t) * cap);
+    tr->dirty = realloc(tr->dirty, sizeof(bool) * cap);
+}
 
 void ax__init_tree(struct ax_tree* tr)
 {
     ax__init_region(&tr->rgn);
-    ax__init_growable(&tr->nodes, DEFAULT_CAPACITY);
+    tr->count = 0;
+    tr->nodes = NULL;
+    tr->first_child = tr->n_children = tr->parent = NULL;
+    tr->avail = tr->hypoth = tr->target = NULL;
+    tr->coord = NULL;
+    tr->extent = NULL;
+    tr->line_count = NULL;
+    tr->hash = NULL;
+    tr->dirty = NULL;
+    resize_tree_arrays(tr, DEFAULT_CAPACITY);
+    ax__init_growable(&tr->dead_text, sizeof(struct ax_text_buf) * 4);
+    tr->text_gen = 0;
 }
 
 void ax__free_tree(struct ax_tree* tr)
 {
     ax__tree_clear(tr);
-    ax__free_growable(&tr->nodes);
+    ax__release_text_bufs(&tr->dead_text);
+    ax__free_growable(&tr->dead_text);
+    free(tr->dirty);
+    free(tr->hash);
+    free(tr->line_count);
+    free(tr->extent);
+    free(tr->coord);
+    free(tr->target);
+    free(tr->hypoth);
+    free(tr->avail);
+    free(tr->parent);
+    free(tr->n_children);
+    free(tr->first_child);
+    free(tr->nodes);
     ax__free_region(&tr->rgn);
 }
 
+node_id ax__new_id(struct ax_tree* tr)
+{
+    if (tr->count >= tr->cap) {
+        resize_tree_arrays(tr, tr->cap * 2);
+    }
+    ASSERT(tr->count < NULL_ID, "too many nodes");
+    node_id id = tr->count++;
+    tr->first_child[id] = NULL_ID;
+    tr->n_children[id] = 0;
+    tr->parent[id] = NULL_ID;
+    tr->dirty[id] = true;
+    return id;
+}
+
 void ax__tree_clear(struct ax_tree* tr)
 {
     DEFINE_TRAVERSAL_LOCALS(tr, node);
     FOR_EACH_FROM_BOTTOM(node) {
         ax__free_node(node);
     }
-    ax__growable_clear(&tr->nodes);
+    tr->count = 0;
     ax__region_clear(&tr->rgn);
 }
 
@@ -33,77 +96,395 @@ void ax__free_node(struct ax_node* node)
 {
     switch (node->ty) {
     case AX_NODE_TEXT:
-        ax__destroy_font(node->t.font);
+        ax__release_font(node->t.font);
+        ax__free_growable(&node->t.line_buf);
+        if (node->t.map != NULL) {
+            munmap(node->t.map, node->t.map_len);
+        }
+        free(node->t.patched_text);
         break;
     default:
         break;
     }
 }
 
-int ax__build_node(struct ax_state* s,
-                   struct ax_backend* bac,
-                   struct ax_tree* tr,
-                   const struct ax_desc* desc,
-                   node_id* out_id)
+void ax__tree_take_text_bufs(struct ax_tree* tr, struct growable* bufs)
+{
+    ax__tree_take_dead_text(tr, bufs);
+    for (node_id id = 0; id < ax__tree_count(tr); id++) {
+        struct ax_node* node = ax__node_by_id(tr, id);
+        if (node->ty != AX_NODE_TEXT) {
+            continue;
+        }
+        if (node->t.map != NULL) {
+            struct ax_text_buf b = { node->t.map, node->t.map_len };
+            PUSH(bufs, &b);
+            node->t.map = NULL;
+        }
+        if (node->t.patched_text != NULL) {
+            struct ax_text_buf b = { node->t.patched_text, 0 };
+            PUSH(bufs, &b);
+            node->t.patched_text = NULL;
+        }
+    }
+}
+
+void ax__tree_take_dead_text(struct ax_tree* tr, struct growable* bufs)
 {
-    // NOT a stack-less traversal :(
+    ax__growable_extend_with(bufs, tr->dead_text.size, tr->dead_text.data);
+    ax__growable_clear(&tr->dead_text);
+    tr->text_gen++;
+}
 
+void ax__release_text_bufs(struct growable* bufs)
+{
+    const struct ax_text_buf* b = bufs->data;
+    for (size_t i = 0; i < LEN(bufs, struct ax_text_buf); i++) {
+        if (b[i].map_len > 0) {
+            munmap(b[i].ptr, b[i].map_len);
+        } else {
+            free(b[i].ptr);
+        }
+    }
+    ax__growable_clear(bufs);
+}
+
+// moves the node's patched text (if any) to the tree's dead text, once 'text' no longer
+// points into it.
+static void retire_patched_text(struct ax_tree* tr, struct ax_node_t* t)
+{
+    if (t->patched_text != NULL) {
+        struct ax_text_buf b = { t->patched_text, 0 };
+        PUSH(&tr->dead_text, &b);
+        t->patched_text = NULL;
+    }
+}
+
+node_id ax__tree_add_node(struct ax_tree* tr, enum ax_node_type ty)
+{
     node_id id = ax__new_id(tr);
     struct ax_node* node = ax__node_by_id(tr, id);
-    node->ty = desc->ty;
-    node->first_child_id = NULL_ID;
-    node->next_node_id = NULL_ID;
-    switch (desc->ty) {
-
-    case AX_NODE_CONTAINER: {
-        node->c.n_lines = 0;
-        node->c.main_justify = desc->c.main_justify;
-        node->c.cross_justify = desc->c.cross_justify;
-        node->c.single_line = desc->c.single_line;
-        node->c.background = desc->c.background;
-        node_id prev_id = NULL_ID;
-        for (const struct ax_desc* child_desc = desc->c.first_child;
-             child_desc != NULL;
-             child_desc = child_desc->flex_attrs.next_child)
-        {
-            // TODO: no recursion!
-            node_id child_id;
-            int r = ax__build_node(s, bac, tr, child_desc, &child_id);
-            if (r != 0) {
-                return r;
-            }
-            struct ax_node* child = ax__node_by_id(tr, child_id);
-            child->grow_factor = child_desc->flex_attrs.grow;
-            child->shrink_factor = child_desc->flex_attrs.shrink;
-            child->cross_justify = child_desc->flex_attrs.cross_justify;
-            if (ID_IS_NULL(prev_id)) {
-                ax__node_by_id(tr, id)->first_child_id = child_id;
-            } else {
-                ax__node_by_id(tr, prev_id)->next_node_id = child_id;
-            }
-            prev_id = child_id;
-        }
+    node->ty = ty;
+    node->key = AX_NO_KEY;
+    node->grow_factor = 0;
+    node->shrink_factor = 1;
+    node->cross_justify = AX_JUSTIFY_START;
+    switch (ty) {
+
+    case AX_NODE_CONTAINER:
+        node->c = (struct ax_node_c) {
+            .n_lines = 0,
+            .line_count = NULL,
+            .main_justify = AX_JUSTIFY_START,
+            .cross_justify = AX_JUSTIFY_START,
+            .single_line = false,
+            .background = AX_NULL_COLOR,
+        };
         break;
-    }
 
     case AX_NODE_RECTANGLE:
-        node->r = desc->r;
+        node->r = (struct ax_rect) {
+            .fill = 0x000000,
+            .size = AX_DIM(0.0, 0.0),
+        };
         break;
 
-    case AX_NODE_TEXT: {
-        struct ax_font* font = NULL;
-        int r = ax__new_font(s, bac, desc->t.font_name, &font);
-        if (r != 0) {
-            return r;
-        }
-        node->t.color = desc->t.color;
-        node->t.text = ax__strdup(&tr->rgn, desc->t.text);
-        node->t.font = font;
+    case AX_NODE_TEXT:
+        // the node is already part of the tree, so it must be safe to free even if its
+        // text and font are never loaded
+        node->t = (struct ax_node_t) {
+            .color = 0x000000,
+            .text = (char*) "",
+            .text_len = 0,
+            .text_cap = 0,
+            .font = NULL,
+            .map = NULL,
+            .patched_text = NULL,
+            .patched_gen = 0,
+            .n_words = 0,
+            .words_cap = 0,
+            .words = NULL,
+            .text_hash = AX_HASH_INIT,
+            .wrap_width = 0.0,
+            .n_wrapped_words = 0,
+            .n_lines = 0,
+            .lines = NULL,
+        };
+        ax__init_growable(&node->t.line_buf, sizeof(struct ax_node_t_line) * 16);
+        break;
+
+    case AX_NODE_LIST:
+        node->l = (struct ax_node_l) {
+            .n_items = 0,
+            .item_size = 0.0,
+            .first_item = 0,
+            .overscan = AX_LIST_DEFAULT_OVERSCAN,
+            .req_first = 0,
+            .req_count = 0,
+        };
         break;
-    }
 
     default: NO_SUCH_NODE_TAG();
     }
-    *out_id = id;
+    return id;
+}
+
+void ax__tree_finish_preorder(struct ax_tree* tr, const node_id* subtree_end)
+{
+    ASSERT(!ax__is_tree_empty(tr) && subtree_end[0] == ax__tree_count(tr),
+           "tree must have a single root");
+
+    // walk the tree breadth-first; the queue 'order' maps new ids to old ids. the
+    // children of a node are found by skipping over each child's subtree in turn.
+    size_t n = ax__tree_count(tr);
+    node_id* order = malloc(sizeof(node_id) * n);
+    struct ax_node* nodes = malloc(sizeof(struct ax_node) * tr->cap);
+    size_t n_queued = 1;
+    order[0] = 0;
+    tr->parent[0] = NULL_ID;
+    for (size_t id = 0; id < n; id++) {
+        node_id old_id = order[id];
+        nodes[id] = tr->nodes[old_id];
+        tr->first_child[id] = NULL_ID;
+        tr->n_children[id] = 0;
+        for (node_id child = old_id + 1;
+             child < subtree_end[old_id];
+             child = subtree_end[child])
+        {
+            if (tr->n_children[id]++ == 0) {
+                tr->first_child[id] = n_queued;
+            }
+            tr->parent[n_queued] = id;
+            order[n_queued++] = child;
+        }
+    }
+    free(tr->nodes);
+    tr->nodes = nodes;
+    free(order);
+}
+
+void ax__text_node_set_string(struct ax_tree* tr, node_id id, const char* str)
+{
+    struct ax_node_t* t = &ax__node_by_id(tr, id)->t;
+    t->text_len = strlen(str);
+    t->text_cap = t->text_len + 1;
+    t->text = ax__strdup(&tr->rgn, str);
+}
+
+int ax__text_node_map_file(struct ax_state* s,
+                           struct ax_tree* tr,
+                           node_id id,
+                           const char* path,
+                           size_t offset,
+                           size_t len)
+{
+    struct ax_node_t* t = &ax__node_by_id(tr, id)->t;
+    char err[256];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        goto error;
+    }
+    size_t size = st.st_size;
+    offset = offset < size ? offset : size;
+    len = len < size - offset ? len : size - offset;
+    t->text_len = len;
+    t->text_cap = 0;
+    if (len == 0) {
+        // (can't map an empty range)
+        t->text = (char*) "";
+        close(fd);
+        return 0;
+    }
+
+    // mappings have to start on a page boundary
+    size_t map_offset = offset - offset % sysconf(_SC_PAGESIZE);
+    void* map = mmap(NULL, len + (offset - map_offset), PROT_READ, MAP_PRIVATE,
+                     fd, map_offset);
+    if (map == MAP_FAILED) {
+        goto error;
+    }
+    close(fd);
+    t->map = map;
+    t->map_len = len + (offset - map_offset);
+    t->text = (char*) map + (offset - map_offset);
     return 0;
+
+error:
+    snprintf(err, sizeof(err), "text-file: %s: %s", path, strerror(errno));
+    ax__set_error(s, err);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return 1;
+}
+
+int ax__text_node_load_font(struct ax_state* s,
+                            struct ax_backend* bac,
+                            struct ax_tree* tr,
+                            node_id id,
+                            const char* font_name)
+{
+    struct ax_node_t* t = &ax__node_by_id(tr, id)->t;
+    return ax__acquire_font(s, bac, font_name, &t->font);
+}
+
+void ax__text_node_segment(struct ax_tree* tr, node_id id)
+{
+    struct ax_node_t* t = &ax__node_by_id(tr, id)->t;
+    // segmentation doesn't depend on the width, so it's only done once here rather than
+    // on every layout
+    size_t n_words = ax__text_segment(t->text, t->text_len, NULL, NULL);
+    t->words = ALLOCATES(&tr->rgn, struct ax_text_word, n_words);
+    t->words_cap = n_words;
+    t->n_words = ax__text_segment(t->text, t->text_len, t->font, t->words);
+    t->text_hash = ax__hash_bytes(t->text, t->text_len);
+}
+
+void ax__tree_mark_dirty(struct ax_tree* tr, node_id id)
+{
+    for (; !ID_IS_NULL(id) && !tr->dirty[id]; id = tr->parent[id]) {
+        tr->dirty[id] = true;
+    }
+}
+
+void ax__text_append(struct ax_tree* tr, node_id id, const char* text)
+{
+    struct ax_node_t* t = &ax__node_by_id(tr, id)->t;
+    ASSERT(ax__node_by_id(tr, id)->ty == AX_NODE_TEXT, "can only append to text nodes");
+
+    // when the buffers run out of room they are reallocated at double the size. the old
+    // ones are left in the region, since the last draw buffer may still point into them.
+    size_t len = strlen(text);
+    if (t->text_len + len + 1 > t->text_cap) {
+        size_t cap = t->text_cap * 2;
+        cap = cap > t->text_len + len + 1 ? cap : t->text_len + len + 1;
+        char* new_text = ax__region_alloc(&tr->rgn, cap);
+        memcpy(new_text, t->text, t->text_len);
+        retire_patched_text(tr, t);
+        t->text = new_text;
+        t->text_cap = cap;
+    }
+    memcpy(t->text + t->text_len, text, len + 1);
+    t->text_len += len;
+    t->text_hash = ax__hash_bytes_from(t->text_hash, text, len);
+
+    // the appended text may continue the last word, so segment again from the start of
+    // that word. (the last entry is the end-of-text word, which is always replaced)
+    size_t first = 0, offset = 0;
+    struct ax_text_word last_word = { 0 };
+    if (t->n_words >= 2) {
+        first = t->n_words - 2;
+        offset = t->words[first].offset;
+        last_word = t->words[first];
+    }
+    size_t n_words = first + ax__text_segment(t->text + offset, t->text_len - offset,
+                                              NULL, NULL);
+    if (n_words > t->words_cap) {
+        size_t cap = t->words_cap * 2;
+        cap = cap > n_words ? cap : n_words;
+        struct ax_text_word* new_words = ALLOCATES(&tr->rgn, struct ax_text_word, cap);
+        memcpy(new_words, t->words, sizeof(struct ax_text_word) * first);
+        t->words = new_words;
+        t->words_cap = cap;
+    }
+    ax__text_segment(t->text + offset, t->text_len - offset, t->font, &t->words[first]);
+    for (size_t i = first; i < n_words; i++) {
+        t->words[i].offset += offset;
+    }
+    if (t->n_words >= 2) {
+        // (whatever came before the word is unchanged)
+        t->words[first].newlines = last_word.newlines;
+        t->words[first].gap_width = last_word.gap_width;
+    }
+    t->n_words = n_words;
+    if (t->n_wrapped_words > first) {
+        t->n_wrapped_words = first;
+    }
+    ax__tree_mark_dirty(tr, id);
+}
+
+// replaces the text of a text node. the old text is overwritten if it fits and was
+// patched in since the last draw; otherwise the draw buffers may still point into it, so
+// it's retired rather than left in the region (which a node patched over and over would
+// fill up). the words aren't drawn, so they're reused if they fit.
+static void patch_text(struct ax_tree* tr, struct ax_node_t* t, const char* str)
+{
+    size_t len = strlen(str);
+    if (t->patched_text == NULL || t->patched_gen != tr->text_gen || len >= t->text_cap) {
+        size_t cap = len + 1;
+        char* text = malloc(cap);
+        ASSERT(text != NULL, "malloc patched text");
+        retire_patched_text(tr, t);
+        t->patched_text = t->text = text;
+        t->patched_gen = tr->text_gen;
+        t->text_cap = cap;
+    }
+    memcpy(t->text, str, len + 1);
+    t->text_len = len;
+    const char* text = t->text;
+    t->text_hash = ax__hash_bytes(text, len);
+
+    size_t n_words = ax__text_segment(text, len, NULL, NULL);
+    if (n_words > t->words_cap) {
+        size_t cap = t->words_cap * 2;
+        cap = cap > n_words ? cap : n_words;
+        t->words = ALLOCATES(&tr->rgn, struct ax_text_word, cap);
+        t->words_cap = cap;
+    }
+    t->n_words = ax__text_segment(text, len, t->font, t->words);
+    t->n_wrapped_words = 0;
+}
+
+bool ax__patch_applies(struct ax_tree* tr, const struct ax_patch* patch)
+{
+    if (patch->id >= ax__tree_count(tr)) {
+        return false;
+    }
+    enum ax_node_type ty = ax__node_by_id(tr, patch->id)->ty;
+    int rect_fields = AX_PATCH_FILL | AX_PATCH_SIZE;
+    int text_fields = AX_PATCH_TEXT;
+    int cont_fields = AX_PATCH_MAIN_JUSTIFY | AX_PATCH_CROSS_JUSTIFY;
+    int list_fields = AX_PATCH_ITEMS;
+    return !((patch->fields & rect_fields) && ty != AX_NODE_RECTANGLE) &&
+        !((patch->fields & text_fields) && ty != AX_NODE_TEXT) &&
+        !((patch->fields & cont_fields) && ty != AX_NODE_CONTAINER) &&
+        !((patch->fields & list_fields) && ty != AX_NODE_LIST);
+}
+
+void ax__tree_patch(struct ax_tree* tr, const struct ax_patch* patch)
+{
+    struct ax_node* node = ax__node_by_id(tr, patch->id);
+    int f = patch->fields;
+    if (f & AX_PATCH_FILL) {
+        node->r.fill = patch->fill;
+    }
+    if (f & AX_PATCH_SIZE) {
+        node->r.size = patch->size;
+    }
+    if (f & AX_PATCH_GROW) {
+        node->grow_factor = patch->grow_factor;
+    }
+    if (f & AX_PATCH_SHRINK) {
+        node->shrink_factor = patch->shrink_factor;
+    }
+    if (f & AX_PATCH_MAIN_JUSTIFY) {
+        node->c.main_justify = patch->main_justify;
+    }
+    if (f & AX_PATCH_CROSS_JUSTIFY) {
+        node->c.cross_justify = patch->cross_justify;
+    }
+    if (f & AX_PATCH_SELF_JUSTIFY) {
+        node->cross_justify = patch->self_justify;
+    }
+    if (f & AX_PATCH_ITEMS) {
+        node->l.n_items = patch->n_items;
+    }
+    if (f & AX_PATCH_TEXT) {
+        patch_text(tr, &node->t, patch->text);
+    }
+    // (the fill is only drawn)
+    if (f & ~AX_PATCH_FILL) {
+        ax__tree_mark_dirty(tr, patch->id);
+    }
 }
@@ -2,6 +2,7 @@
 #include <assert.h> // assert
 #include <stdio.h>  // print
 #include <stdlib.h> // exit
+#include <stdint.h> // uint64_t
 
 #define LENGTH(a) (sizeof(a) / sizeof(a[0]))
 
@@ -17,3 +18,37 @@
 #define NO_SUCH_TAG(ty) ASSERT(0, "no such " ty " tag")
 
 #define GUARD(e) if ((rv = e) != 0) { goto err; }
+
+// FNV-1a, for the various interning tables
+#define AX_HASH_INIT 0xcbf29ce484222325ULL
+
+// continues the hash 'h' over more bytes, so that hashing a string in pieces gives the
+// same result as hashing it at once
+static inline size_t ax__hash_bytes_from(uint64_t h, const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) s[i]) * 0x100000001b3ULL;
+    }
+    return (size_t) h;
+}
+
+static inline size_t ax__hash_bytes(const char* s, size_t len)
+{
+    return ax__hash_bytes_from(AX_HASH_INIT, s, len);
+}
+
+static inline size_t ax__hash_str(const char* s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+    }
+    return (size_t) h;
+}
+
+static inline size_t ax__hash_ptr(const void* p)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p;
+    h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+    return (size_t) (h ^ (h >> 33));
+}
@@ -54,6 +54,13 @@ extern const char* _ax_false_str;
           "\"%s\" does not equal \"%s\"",       \
           (_lhs), (_rhs))
 
+// compare a string that isn't null terminated
+#define CHECK_STRNEQ(_lhs, _lhs_len, _rhs)                      \
+    CHECK((_lhs_len) == strlen(_rhs) &&                         \
+          strncmp(_lhs, _rhs, _lhs_len) == 0,                   \
+          "\"%.*s\" does not equal \"%s\"",                     \
+          (int) (_lhs_len), (_lhs), (_rhs))
+
 #define CHECK_PEQ(_lhs, _rhs)                   \
     CHECK((void*) (_lhs) == (void*) (_rhs),     \
           "%p does not equal %p",               \
@@ -83,14 +90,33 @@ static inline int _ax_float_eq_threshold(float t, float x, float y)
           "%.3f does not equal %.3f",                       \
           (_lhs), (_rhs))
 
+// lengths in pixels, whatever the representation of ax_length (see base.h)
+#define PX_POS(_x, _y) AX_POS(AX_LENGTH(_x), AX_LENGTH(_y))
+#define PX_DIM(_w, _h) AX_DIM(AX_LENGTH(_w), AX_LENGTH(_h))
+#define PX(_l) AX_LENGTH_TO_DOUBLE(_l)
+
+// (fixed point lengths are only accurate to 1/64 of a pixel, and a little less after
+// rounding in a few divisions)
+#if defined(AX_LENGTH_FIXED)
+#define PX_EQ(_t, _x, _y) _ax_float_eq_threshold(2.0 / 64, _x, _y)
+#else
+#define PX_EQ(_t, _x, _y) _ax_float_eq_threshold(_t, _x, _y)
+#endif
+
+// compares a length with a number of pixels
+#define CHECK_LENEQ(_lhs, _rhs)                 \
+    CHECK(PX_EQ(0.001, PX(_lhs), _rhs),         \
+          "%.3f does not equal %.3f",           \
+          PX(_lhs), (double) (_rhs))
+
 #define CHECK_POSEQ(_lhs, _rhs)                                 \
-    CHECK(_ax_float_eq_threshold(0.01, (_lhs).x, (_rhs).x) &&   \
-          _ax_float_eq_threshold(0.01, (_lhs).y, (_rhs).y),     \
+    CHECK(PX_EQ(0.01, PX((_lhs).x), PX((_rhs).x)) &&            \
+          PX_EQ(0.01, PX((_lhs).y), PX((_rhs).y)),              \
           "(%.2f, %.2f) does not equal (%.2f, %.2f)",           \
-          (_lhs).x, (_lhs).y, (_rhs).x, (_rhs).y)
+          PX((_lhs).x), PX((_lhs).y), PX((_rhs).x), PX((_rhs).y))
 
 #define CHECK_DIMEQ(_lhs, _rhs)                                 \
-    CHECK(_ax_float_eq_threshold(0.01, (_lhs).w, (_rhs).w) &&   \
-          _ax_float_eq_threshold(0.01, (_lhs).h, (_rhs).h),     \
+    CHECK(PX_EQ(0.01, PX((_lhs).w), PX((_rhs).w)) &&            \
+          PX_EQ(0.01, PX((_lhs).h), PX((_rhs).h)),              \
           "%.2fx%.2f does not equal %.2fx%.2f",                 \
-          (_lhs).w, (_lhs).h, (_rhs).w, (_rhs).h)
+          PX((_lhs).w), PX((_lhs).h), PX((_rhs).w), PX((_rhs).h))
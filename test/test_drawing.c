@@ -4,6 +4,8 @@
 #include "../src/core.h"
 #include "../src/draw.h"
 #include "../src/utils.h"
+#include "../src/core/async.h"
+#include <unistd.h>
 
 #define D(_idx) s->backend->ds[_idx]
 #define D_LEN() s->backend->ds_len
@@ -51,8 +53,8 @@ TEST(draw_1r)
     CHECK_SZEQ(D_LEN(), (size_t) 1);
     CHECK_IEQ(D(0).ty, AX_DRAW_RECT);
     CHECK_IEQ(D(0).r.fill, 0xff0033);
-    CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(0).r.bounds.s, AX_DIM(60.0, 80.0));
+    CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(0).r.bounds.s, PX_DIM(60.0, 80.0));
     ax_destroy_state(s);
 }
 
@@ -83,16 +85,16 @@ TEST(draw_3r)
     CHECK_SZEQ(D_LEN(), (size_t) 3);
     CHECK_IEQ(D(0).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(0).r.fill, 0xff0000);
-    CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 70.0));
-    CHECK_DIMEQ(D(0).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 70.0));
+    CHECK_DIMEQ(D(0).r.bounds.s, PX_DIM(60.0, 60.0));
     CHECK_IEQ(D(1).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(1).r.fill, 0x00ff00);
-    CHECK_POSEQ(D(1).r.bounds.o, AX_POS(90.0, 70.0));
-    CHECK_DIMEQ(D(1).r.bounds.s, AX_DIM(20.0, 20.0));
+    CHECK_POSEQ(D(1).r.bounds.o, PX_POS(90.0, 70.0));
+    CHECK_DIMEQ(D(1).r.bounds.s, PX_DIM(20.0, 20.0));
     CHECK_IEQ(D(2).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(2).r.fill, 0x0000ff);
-    CHECK_POSEQ(D(2).r.bounds.o, AX_POS(140.0, 70.0));
-    CHECK_DIMEQ(D(2).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(2).r.bounds.o, PX_POS(140.0, 70.0));
+    CHECK_DIMEQ(D(2).r.bounds.s, PX_DIM(60.0, 60.0));
     ax_destroy_state(s);
 }
 
@@ -111,9 +113,9 @@ TEST(draw_3r_threading_stress_test)
                  "            (cross-justify center)))");
         SYNC(3);
         CHECK_SZEQ(D_LEN(), (size_t) 3);
-        CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 70.0));
-        CHECK_POSEQ(D(1).r.bounds.o, AX_POS(90.0, 70.0));
-        CHECK_POSEQ(D(2).r.bounds.o, AX_POS(140.0, 70.0));
+        CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 70.0));
+        CHECK_POSEQ(D(1).r.bounds.o, PX_POS(90.0, 70.0));
+        CHECK_POSEQ(D(2).r.bounds.o, PX_POS(140.0, 70.0));
         ax_destroy_state(s);
     }
 #endif
@@ -150,9 +152,9 @@ TEST(draw_text_1l)
     CHECK_SZEQ(D_LEN(), (size_t) 1);
     CHECK_IEQ(D(0).ty, AX_DRAW_TEXT);
     CHECK_IEQ_HEX(D(0).t.color, 0x111111);
-    CHECK_POSEQ(D(0).t.pos, AX_POS(0.0, 0.0));
-    CHECK_STREQ(D(0).t.text, "Hello, world");
-    CHECK_FLEQ(0.0001, *(ax_length*) D(0).t.font, 10.0);
+    CHECK_POSEQ(D(0).t.pos, PX_POS(0.0, 0.0));
+    CHECK_STRNEQ(D(0).t.text, D(0).t.len, "Hello, world");
+    CHECK_LENEQ(*(ax_length*) D(0).t.font, 10.0);
     ax_destroy_state(s);
 }
 
@@ -169,14 +171,14 @@ TEST(draw_text_2l)
     CHECK_SZEQ(D_LEN(), (size_t) 2);
     CHECK_IEQ(D(0).ty, AX_DRAW_TEXT);
     CHECK_IEQ_HEX(D(0).t.color, 0x111111);
-    CHECK_POSEQ(D(0).t.pos, AX_POS(0.0, 0.0));
-    CHECK_STREQ(D(0).t.text, "Hello,");
-    CHECK_FLEQ(0.0001, *(ax_length*) D(0).t.font, 10.0);
+    CHECK_POSEQ(D(0).t.pos, PX_POS(0.0, 0.0));
+    CHECK_STRNEQ(D(0).t.text, D(0).t.len, "Hello,");
+    CHECK_LENEQ(*(ax_length*) D(0).t.font, 10.0);
     CHECK_IEQ(D(1).ty, AX_DRAW_TEXT);
     CHECK_IEQ_HEX(D(1).t.color, 0x111111);
-    CHECK_POSEQ(D(1).t.pos, AX_POS(0.0, 10.0));
-    CHECK_STREQ(D(1).t.text, "world");
-    CHECK_FLEQ(0.0001, *(ax_length*) D(1).t.font, 10.0);
+    CHECK_POSEQ(D(1).t.pos, PX_POS(0.0, 10.0));
+    CHECK_STRNEQ(D(1).t.text, D(1).t.len, "world");
+    CHECK_LENEQ(*(ax_length*) D(1).t.font, 10.0);
     ax_destroy_state(s);
 }
 
@@ -196,18 +198,18 @@ TEST(draw_2r_bg)
     // container
     CHECK_IEQ(D(0).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(0).r.fill, 0x00ff00);
-    CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(0).r.bounds.s, AX_DIM(200.0, 200.0));
+    CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(0).r.bounds.s, PX_DIM(200.0, 200.0));
     // red rect
     CHECK_IEQ(D(1).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(1).r.fill, 0xff0000);
-    CHECK_POSEQ(D(1).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(1).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(1).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(1).r.bounds.s, PX_DIM(60.0, 60.0));
     // blue rect
     CHECK_IEQ(D(2).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(2).r.fill, 0x0000ff);
-    CHECK_POSEQ(D(2).r.bounds.o, AX_POS(60.0, 0.0));
-    CHECK_DIMEQ(D(2).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(2).r.bounds.o, PX_POS(60.0, 0.0));
+    CHECK_DIMEQ(D(2).r.bounds.s, PX_DIM(60.0, 60.0));
     ax_destroy_state(s);
 }
 
@@ -229,28 +231,28 @@ TEST(draw_nested_bg)
     // outer container
     CHECK_IEQ(D(0).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(0).r.fill, 0xffff00);
-    CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(0).r.bounds.s, AX_DIM(200.0, 200.0));
+    CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(0).r.bounds.s, PX_DIM(200.0, 200.0));
     // inner container
     CHECK_IEQ(D(1).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(1).r.fill, 0xff00ff);
-    CHECK_POSEQ(D(1).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(1).r.bounds.s, AX_DIM(120.0, 60.0));
+    CHECK_POSEQ(D(1).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(1).r.bounds.s, PX_DIM(120.0, 60.0));
     // red rect
     CHECK_IEQ(D(2).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(2).r.fill, 0xff0000);
-    CHECK_POSEQ(D(2).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(2).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(2).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(2).r.bounds.s, PX_DIM(60.0, 60.0));
     // green rect
     CHECK_IEQ(D(3).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(3).r.fill, 0x00ff00);
-    CHECK_POSEQ(D(3).r.bounds.o, AX_POS(60.0, 0.0));
-    CHECK_DIMEQ(D(3).r.bounds.s, AX_DIM(60.0, 20.0));
+    CHECK_POSEQ(D(3).r.bounds.o, PX_POS(60.0, 0.0));
+    CHECK_DIMEQ(D(3).r.bounds.s, PX_DIM(60.0, 20.0));
     // blue rect
     CHECK_IEQ(D(4).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(4).r.fill, 0x0000ff);
-    CHECK_POSEQ(D(4).r.bounds.o, AX_POS(120.0, 0.0));
-    CHECK_DIMEQ(D(4).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(4).r.bounds.o, PX_POS(120.0, 0.0));
+    CHECK_DIMEQ(D(4).r.bounds.s, PX_DIM(60.0, 60.0));
     ax_destroy_state(s);
 }
 
@@ -272,27 +274,74 @@ TEST(draw_nested_2_bg)
     // outer container
     CHECK_IEQ(D(0).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(0).r.fill, 0xffff00);
-    CHECK_POSEQ(D(0).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(0).r.bounds.s, AX_DIM(200.0, 200.0));
+    CHECK_POSEQ(D(0).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(0).r.bounds.s, PX_DIM(200.0, 200.0));
     // blue rect
     CHECK_IEQ(D(1).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(1).r.fill, 0x0000ff);
-    CHECK_POSEQ(D(1).r.bounds.o, AX_POS(0.0, 0.0));
-    CHECK_DIMEQ(D(1).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(1).r.bounds.o, PX_POS(0.0, 0.0));
+    CHECK_DIMEQ(D(1).r.bounds.s, PX_DIM(60.0, 60.0));
     // inner container
     CHECK_IEQ(D(2).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(2).r.fill, 0xff00ff);
-    CHECK_POSEQ(D(2).r.bounds.o, AX_POS(60.0, 0.0));
-    CHECK_DIMEQ(D(2).r.bounds.s, AX_DIM(120.0, 60.0));
+    CHECK_POSEQ(D(2).r.bounds.o, PX_POS(60.0, 0.0));
+    CHECK_DIMEQ(D(2).r.bounds.s, PX_DIM(120.0, 60.0));
     // red rect
     CHECK_IEQ(D(3).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(3).r.fill, 0xff0000);
-    CHECK_POSEQ(D(3).r.bounds.o, AX_POS(60.0, 0.0));
-    CHECK_DIMEQ(D(3).r.bounds.s, AX_DIM(60.0, 60.0));
+    CHECK_POSEQ(D(3).r.bounds.o, PX_POS(60.0, 0.0));
+    CHECK_DIMEQ(D(3).r.bounds.s, PX_DIM(60.0, 60.0));
     // green rect
     CHECK_IEQ(D(4).ty, AX_DRAW_RECT);
     CHECK_IEQ_HEX(D(4).r.fill, 0x00ff00);
-    CHECK_POSEQ(D(4).r.bounds.o, AX_POS(120.0, 0.0));
-    CHECK_DIMEQ(D(4).r.bounds.s, AX_DIM(60.0, 20.0));
+    CHECK_POSEQ(D(4).r.bounds.o, PX_POS(120.0, 0.0));
+    CHECK_DIMEQ(D(4).r.bounds.s, PX_DIM(60.0, 20.0));
+    ax_destroy_state(s);
+}
+
+TEST(draw_only_inside_window)
+{
+    // a column of 100 rows, of which the first 10 fit in the window
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 100 100))");
+    ax_write_string(s, "(set-root (container (children");
+    for (int i = 0; i < 100; i++) {
+        ax_write_string(s, "(rect (fill \"ff0000\") (size 100 10))");
+    }
+    ax_write_string(s, "(text \"Foo bar\" (font \"size:10\"))");
+    ax_write_string(s, ")))");
+    CHECK_IEQ(ax_write_end(s), 0);
+
+    SYNC(10);
+    CHECK_SZEQ(D_LEN(), (size_t) 10);
+    CHECK_POSEQ(D(9).r.bounds.o, PX_POS(0.0, 90.0));
+    ax_destroy_state(s);
+}
+
+TEST(draw_mapped_text_outlives_tree)
+{
+    char path[] = "/tmp/ax_test_text_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK_TRUE(fd >= 0);
+    CHECK_IEQ((int) write(fd, "Hello", 5), 5);
+    close(fd);
+    char input[256];
+    snprintf(input, sizeof(input),
+             "(init (window-size 100 100))"
+             "(set-root (text-file \"%s\" 0 5 (font \"size:10\")))", path);
+    struct ax_state* s = ax_new_state();
+    CHECK_IEQ(ax_write(s, input), 0);
+    unlink(path);
+    SYNC(1);
+
+    // the tree is replaced while the frame with the mapped text is still displayed, so
+    // the text has to stay mapped until the next frame replaces it
+    ax_test_backend_hold_frame(s->backend);
+    CHECK_IEQ(D(0).ty, AX_DRAW_TEXT);
+    CHECK_IEQ(ax_write(s, "(set-root (rect (size 10 10)))"), 0);
+    ax__async_wait_for_layout(s->async);
+    CHECK_STRNEQ(D(0).t.text, D(0).t.len, "Hello");
+    ax_test_backend_release_frame(s->backend);
     ax_destroy_state(s);
 }
@@ -1,6 +1,8 @@
 #include "helpers.h"
 #include "../src/ax.h"
 #include "../src/core.h"
+#include "../src/core/async.h"
+#include "../src/geom.h"
 #include "../backend/fortest.h"
 
 TEST(evt_poll_empty)
@@ -22,3 +24,40 @@ TEST(evt_close)
     }
     ax_destroy_state(ax);
 }
+
+TEST(evt_list_rows)
+{
+    struct ax_state* ax = ax_new_state();
+    struct ax_event e;
+    ax_write(ax,
+             "(init (window-size 100 100))"
+             "(set-root (list (children) (items 1000) (item-size 10) (key 7)))");
+    CHECK_TRUE(ax_read_event(ax, &e));
+    CHECK_IEQ(e.ty, AX_EVENT_ROWS);
+    CHECK_SZEQ(e.rows.id, (size_t) 0);
+    CHECK_LEQ(e.rows.key, (int64_t) 7);
+    CHECK_SZEQ(e.rows.first, (size_t) 0);
+    CHECK_SZEQ(e.rows.count, (size_t) 14);
+
+    // once the list has those rows, it doesn't need any more
+    ax_write_start(ax);
+    ax_write_string(ax, "(set-root (list (children");
+    for (int i = 0; i < 14; i++) {
+        ax_write_string(ax, "(rect (size 10 10))");
+    }
+    ax_write_string(ax, ") (items 1000) (item-size 10) (key 7)))");
+    CHECK_IEQ(ax_write_end(ax), 0);
+    ax__async_wait_for_layout(ax->async);
+    CHECK_TRUE(ax__is_growable_empty(&ax->geom->row_requests));
+
+    // until the window grows
+    ax__set_dim(ax, PX_DIM(100, 200));
+    CHECK_TRUE(ax_read_event(ax, &e));
+    CHECK_IEQ(e.ty, AX_EVENT_ROWS);
+    CHECK_SZEQ(e.rows.first, (size_t) 0);
+    CHECK_SZEQ(e.rows.count, (size_t) 24);
+
+    ax_test_backend_sig_close(ax->backend);
+    ax_read_close_event(ax);
+    ax_destroy_state(ax);
+}
@@ -3,8 +3,17 @@
 #include "../src/core.h"
 #include "../src/core/async.h"
 #include "../src/tree.h"
+#include "../src/geom.h"
+#include "../src/geom/flex.h"
+#include "../src/core/growable.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 
 #define N(_id)  ax__node_by_id(s->tree, _id)
+#define HYPOTH(_id)  (s->tree->hypoth[_id])
+#define TARGET(_id)  (s->tree->target[_id])
+#define COORD(_id)   (s->tree->coord[_id])
 #define SYNC()  ax__async_wait_for_layout(s->async)
 
 TEST(empty_root_node)
@@ -14,6 +23,31 @@ TEST(empty_root_node)
     ax_destroy_state(s);
 }
 
+TEST(build_tree_breadth_first)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 200 200))"
+             "(set-root"
+             " (container (children (container (children (rect) (rect)))"
+             "                      (rect (grow 2))"
+             "                      (text \"hi\"))))");
+    SYNC();
+    CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 6);
+    // the root's children come first, then the inner container's
+    CHECK_IEQ(s->tree->first_child[0], 1);
+    CHECK_IEQ(s->tree->n_children[0], 3);
+    CHECK_IEQ(N(1)->ty, AX_NODE_CONTAINER);
+    CHECK_IEQ(N(2)->ty, AX_NODE_RECTANGLE);
+    CHECK_IEQ(N(2)->grow_factor, 2);
+    CHECK_IEQ(N(3)->ty, AX_NODE_TEXT);
+    CHECK_IEQ(s->tree->first_child[1], 4);
+    CHECK_IEQ(s->tree->n_children[1], 2);
+    CHECK_IEQ(N(5)->ty, AX_NODE_RECTANGLE);
+    CHECK_IEQ(s->tree->n_children[5], 0);
+    ax_destroy_state(s);
+}
+
 #define TWO_RECTS                               \
     "(rect (fill \"ff0000\") (size 60 60))"     \
     "(rect (fill \"0000ff\") (size 60 60))"
@@ -32,8 +66,8 @@ TEST(build_tree)
     CHECK_IEQ(N(2)->ty, AX_NODE_RECTANGLE);
     CHECK_IEQ_HEX(N(1)->r.fill, 0xff0000);
     CHECK_IEQ_HEX(N(2)->r.fill, 0x0000ff);
-    CHECK_DIMEQ(N(1)->r.size, AX_DIM(60, 60));
-    CHECK_DIMEQ(N(2)->r.size, AX_DIM(60, 60));
+    CHECK_DIMEQ(N(1)->r.size, PX_DIM(60, 60));
+    CHECK_DIMEQ(N(2)->r.size, PX_DIM(60, 60));
     ax_destroy_state(s);
 }
 
@@ -47,8 +81,8 @@ TEST(build_tree)
                  "                     (main-justify " _mj ")"      \
                  "                     (cross-justify " _xj ")))"); \
         SYNC();                                                     \
-        CHECK_POSEQ(N(1)->coord, AX_POS(_x0, _y0));                 \
-        CHECK_POSEQ(N(2)->coord, AX_POS(_x1, _y1));                 \
+        CHECK_POSEQ(COORD(1), PX_POS(_x0, _y0));                 \
+        CHECK_POSEQ(COORD(2), PX_POS(_x1, _y1));                 \
         ax_destroy_state(s);                                        \
     } while(0)
 
@@ -81,12 +115,12 @@ TEST(resize_2r)
              " (container (children " TWO_RECTS ")"
              "            (main-justify between)))");
     SYNC();
-    CHECK_POSEQ(N(1)->coord, AX_POS(0, 0));
-    CHECK_POSEQ(N(2)->coord, AX_POS(140, 0));
-    ax__set_dim(s, AX_DIM(300, 300));
+    CHECK_POSEQ(COORD(1), PX_POS(0, 0));
+    CHECK_POSEQ(COORD(2), PX_POS(140, 0));
+    ax__set_dim(s, PX_DIM(300, 300));
     SYNC();
-    CHECK_POSEQ(N(1)->coord, AX_POS(0, 0));
-    CHECK_POSEQ(N(2)->coord, AX_POS(240, 0));
+    CHECK_POSEQ(COORD(1), PX_POS(0, 0));
+    CHECK_POSEQ(COORD(2), PX_POS(240, 0));
 }
 
 /* Fitting a single text node into a window */
@@ -101,8 +135,8 @@ TEST(resize_2r)
     SYNC();                                             \
     CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 1);             \
     CHECK_IEQ(N(0)->ty, AX_NODE_TEXT);                  \
-    CHECK_FLEQ(0.001, N(0)->hypoth.w, (float) (_expw)); \
-    CHECK_FLEQ(0.001, N(0)->hypoth.h, (float) (_exph)); \
+    CHECK_LENEQ(HYPOTH(0).w, (float) (_expw)); \
+    CHECK_LENEQ(HYPOTH(0).h, (float) (_exph)); \
     ax_destroy_state(s)
 
 TEST(text_geom_2w_1l)
@@ -116,6 +150,45 @@ TEST(text_geom_3w_2l)
 
 #undef TEXT_TEST
 
+TEST(text_lines_newlines)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 100 100))"
+             "(set-root (text \"Foo bar baz\n\nHello\" (font \"size:10\")))");
+    SYNC();
+    CHECK_SZEQ(N(0)->t.n_lines, (size_t) 4);
+    CHECK_LENEQ(N(0)->t.lines[0].width, 70.0);
+    CHECK_LENEQ(N(0)->t.lines[1].width, 30.0);
+    CHECK_LENEQ(N(0)->t.lines[2].width, 0.0);
+    CHECK_SZEQ(N(0)->t.lines[2].len, (size_t) 0);
+    CHECK_LENEQ(N(0)->t.lines[3].width, 50.0);
+    CHECK_DIMEQ(HYPOTH(0), PX_DIM(70.0, 40.0));
+    ax_destroy_state(s);
+}
+
+TEST(text_lines_reused_for_target)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 100 100))"
+             "(set-root"
+             " (container (children (text \"Hello, world\" (font \"size:10\")))))");
+    SYNC();
+    // the target width (60) differs from the available width (100) but gives the same
+    // lines, so the text isn't re-wrapped at the target width
+    CHECK_LENEQ(TARGET(1).w, 60.0);
+    CHECK_LENEQ(N(1)->t.wrap_width, 100.0);
+    CHECK_SZEQ(N(1)->t.n_lines, (size_t) 2);
+    CHECK_SZEQ(N(1)->t.lines[0].offset, (size_t) 0);
+    CHECK_SZEQ(N(1)->t.lines[0].len, (size_t) 6);
+    CHECK_SZEQ(N(1)->t.lines[1].offset, (size_t) 7);
+    CHECK_SZEQ(N(1)->t.lines[1].len, (size_t) 5);
+    CHECK_LENEQ(N(1)->t.lines[1].width, 50.0);
+    CHECK_POSEQ(N(1)->t.lines[1].coord, PX_POS(0.0, 10.0));
+    ax_destroy_state(s);
+}
+
 
 TEST(spill_3r)
 {
@@ -133,9 +206,9 @@ TEST(spill_3r)
     CHECK_SZEQ(N(0)->c.n_lines, (size_t) 2);
     CHECK_SZEQ(N(0)->c.line_count[0], (size_t) 2);
     CHECK_SZEQ(N(0)->c.line_count[1], (size_t) 1);
-    CHECK_POSEQ(N(1)->coord, AX_POS(0.0, 0.0));
-    CHECK_POSEQ(N(2)->coord, AX_POS(80.0, 0.0));
-    CHECK_POSEQ(N(3)->coord, AX_POS(0.0, 80.0));
+    CHECK_POSEQ(COORD(1), PX_POS(0.0, 0.0));
+    CHECK_POSEQ(COORD(2), PX_POS(80.0, 0.0));
+    CHECK_POSEQ(COORD(3), PX_POS(0.0, 80.0));
 }
 
 TEST(shrink_3r)
@@ -153,12 +226,12 @@ TEST(shrink_3r)
     CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 4);
     CHECK_SZEQ(N(0)->c.n_lines, (size_t) 1);
     CHECK_SZEQ(N(0)->c.line_count[0], (size_t) 3);
-    CHECK_POSEQ(N(1)->coord, AX_POS(0.0, 0.0));
-    CHECK_POSEQ(N(2)->coord, AX_POS(66.66, 0.0));
-    CHECK_POSEQ(N(3)->coord, AX_POS(133.33, 0.0));
-    CHECK_DIMEQ(N(1)->target, AX_DIM(66.66, 80.0));
-    CHECK_DIMEQ(N(2)->target, AX_DIM(66.66, 80.0));
-    CHECK_DIMEQ(N(3)->target, AX_DIM(66.66, 80.0));
+    CHECK_POSEQ(COORD(1), PX_POS(0.0, 0.0));
+    CHECK_POSEQ(COORD(2), PX_POS(66.66, 0.0));
+    CHECK_POSEQ(COORD(3), PX_POS(133.33, 0.0));
+    CHECK_DIMEQ(TARGET(1), PX_DIM(66.66, 80.0));
+    CHECK_DIMEQ(TARGET(2), PX_DIM(66.66, 80.0));
+    CHECK_DIMEQ(TARGET(3), PX_DIM(66.66, 80.0));
     ax_destroy_state(s);
 }
 
@@ -177,11 +250,687 @@ TEST(shrink_3r_asym)
     CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 4);
     CHECK_SZEQ(N(0)->c.n_lines, (size_t) 1);
     CHECK_SZEQ(N(0)->c.line_count[0], (size_t) 3);
-    CHECK_POSEQ(N(1)->coord, AX_POS(0.0, 0.0));
-    CHECK_POSEQ(N(2)->coord, AX_POS(80.0, 0.0));
-    CHECK_POSEQ(N(3)->coord, AX_POS(140, 0.0));
-    CHECK_DIMEQ(N(1)->target, AX_DIM(80.0, 80.0)); // shrink_factor=0
-    CHECK_DIMEQ(N(2)->target, AX_DIM(60.0, 80.0));
-    CHECK_DIMEQ(N(3)->target, AX_DIM(60.0, 80.0));
+    CHECK_POSEQ(COORD(1), PX_POS(0.0, 0.0));
+    CHECK_POSEQ(COORD(2), PX_POS(80.0, 0.0));
+    CHECK_POSEQ(COORD(3), PX_POS(140, 0.0));
+    CHECK_DIMEQ(TARGET(1), PX_DIM(80.0, 80.0)); // shrink_factor=0
+    CHECK_DIMEQ(TARGET(2), PX_DIM(60.0, 80.0));
+    CHECK_DIMEQ(TARGET(3), PX_DIM(60.0, 80.0));
+    ax_destroy_state(s);
+}
+
+TEST(text_lines_parallel_paragraphs)
+{
+    // enough paragraphs to be wrapped on several workers; every paragraph is two lines
+    size_t n_paras = AX_PARALLEL_WRAP_MIN_WORDS;
+    struct growable buf;
+    ax__init_growable(&buf, 256);
+    ax__growable_clear_str(&buf);
+    ax__growable_push_str(&buf,
+                          "(init (window-size 50 100))"
+                          "(set-root (text \"");
+    for (size_t i = 0; i < n_paras; i++) {
+        ax__growable_push_str(&buf, "aa bb cc dd\n");
+    }
+    ax__growable_push_str(&buf, "\" (font \"size:10\")))");
+
+    struct ax_state* s = ax_new_state();
+    ax__set_layout_workers(s->geom, 4);
+    ax_write(s, buf.data);
+    SYNC();
+    CHECK_SZEQ(N(0)->t.n_lines, n_paras * 2 + 1);
+    bool lines_ok = true;
+    for (size_t i = 0; i < n_paras * 2; i++) {
+        const struct ax_node_t_line* l = &N(0)->t.lines[i];
+        lines_ok = lines_ok && l->offset == (i / 2) * 12 + (i % 2) * 6 && l->len == 5;
+    }
+    CHECK_TRUE(lines_ok);
+    CHECK_SZEQ(N(0)->t.lines[n_paras * 2].len, (size_t) 0);
+    CHECK_DIMEQ(HYPOTH(0), PX_DIM(50.0, 10.0 * (n_paras * 2 + 1)));
+    ax_destroy_state(s);
+    ax__free_growable(&buf);
+}
+
+TEST(text_append)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 100 100))"
+             "(set-root (container (children"
+             " (rect (size 10 10))"
+             " (text \"Foo bar baz\nHello\" (font \"size:10\")))))");
+    SYNC();
+    CHECK_SZEQ(N(2)->t.n_lines, (size_t) 3);
+
+    // the appended text continues the last word
+    CHECK_IEQ(ax_write(s, "(append-text 2 \"world qux\n\nlast\")"), 0);
+    SYNC();
+    CHECK_STREQ(N(2)->t.text, "Foo bar baz\nHelloworld qux\n\nlast");
+    CHECK_SZEQ(N(2)->t.n_lines, (size_t) 6);
+    CHECK_SZEQ(N(2)->t.lines[2].offset, (size_t) 12);
+    CHECK_SZEQ(N(2)->t.lines[2].len, (size_t) 10);
+    CHECK_LENEQ(N(2)->t.lines[2].width, 100.0);
+    CHECK_SZEQ(N(2)->t.lines[3].offset, (size_t) 23);
+    CHECK_SZEQ(N(2)->t.lines[4].len, (size_t) 0);
+    CHECK_SZEQ(N(2)->t.lines[5].offset, (size_t) 28);
+    CHECK_POSEQ(N(2)->t.lines[5].coord, PX_POS(0.0, 60.0));
+    CHECK_DIMEQ(HYPOTH(2), PX_DIM(100.0, 60.0));
+
+    // same lines as if the whole text had been set at once
+    CHECK_IEQ(ax_write(s, "(append-text 2 \" and more\")"), 0);
+    SYNC();
+    CHECK_SZEQ(N(2)->t.n_lines, (size_t) 7);
+    CHECK_SZEQ(N(2)->t.lines[5].len, (size_t) 8);
+    CHECK_SZEQ(N(2)->t.lines[6].offset, (size_t) 37);
+    CHECK_SZEQ(N(2)->t.lines[6].len, (size_t) 4);
+
+    CHECK_IEQ(ax_write(s, "(append-text 1 \"nope\")"), 1);
+    CHECK_STREQ(ax_get_error(s), "append-text: not a text node");
+    ax_destroy_state(s);
+}
+
+TEST(reconcile_by_key)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 200 100))"
+             "(set-root (container (children"
+             " (rect (key 2) (size 30 10))"
+             " (text \"Foo bar\" (key 3))"
+             " (rect (size 10 10))) (key 1)))");
+    SYNC();
+    CHECK_POSEQ(COORD(2), PX_POS(30.0, 0.0));
+    const struct ax_node_t_line* lines = N(2)->t.lines;
+
+    // the text is taken over from the previous tree, and only moved
+    ax_write(s,
+             "(set-root (container (children"
+             " (rect (key 2) (size 40 10))"
+             " (text \"Foo bar\" (key 3))"
+             " (rect (size 10 10))) (key 1)))");
+    SYNC();
+    CHECK(N(2)->t.lines == lines, "lines should be taken over");
+    CHECK_SZEQ(N(2)->t.n_lines, (size_t) 1);
+    CHECK_POSEQ(COORD(2), PX_POS(40.0, 0.0));
+    CHECK_POSEQ(N(2)->t.lines[0].coord, PX_POS(40.0, 0.0));
+    CHECK_POSEQ(COORD(3), PX_POS(110.0, 0.0));
+
+    // colors don't change the layout, so a recolored subtree is still taken over
+    ax_write(s,
+             "(set-root (container (children"
+             " (rect (key 2) (size 40 10))"
+             " (text \"Foo bar\" (key 3) (color \"ff0000\"))"
+             " (rect (size 10 10))) (key 1) (background \"0000ff\")))");
+    SYNC();
+    CHECK(N(2)->t.lines == lines, "lines should be taken over");
+    CHECK_IEQ_HEX(N(2)->t.color, 0xff0000);
+    CHECK_IEQ_HEX(N(0)->c.background, 0x0000ff);
+    CHECK_POSEQ(N(2)->t.lines[0].coord, PX_POS(40.0, 0.0));
+
+    // a changed subtree isn't taken over, even if its key matches
+    ax_write(s,
+             "(set-root (container (children"
+             " (rect (key 2) (size 40 10))"
+             " (text \"Foo bar baz\" (key 3))) (key 1)))");
+    SYNC();
+    CHECK(N(2)->t.lines != lines, "lines should be new");
+    CHECK_DIMEQ(HYPOTH(2), PX_DIM(110.0, 10.0));
+
+    // clean subtrees still follow a resize
+    ax__async_set_dim(s->async, PX_DIM(100.0, 100.0));
+    SYNC();
+    CHECK_SZEQ(N(2)->t.n_lines, (size_t) 2);
+    CHECK_POSEQ(COORD(2), PX_POS(0.0, 10.0));
+    ax_destroy_state(s);
+}
+
+TEST(patch_nodes)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 200 100))"
+             "(set-root (container (children"
+             " (rect (size 30 10))"
+             " (text \"Foo bar\")"
+             " (rect (size 10 10)))))");
+    SYNC();
+    CHECK_POSEQ(COORD(3), PX_POS(100.0, 0.0));
+
+    CHECK_IEQ(ax_write(s, "(patch 1 (size 40 20) (fill \"00ff00\"))"), 0);
+    SYNC();
+    CHECK_IEQ_HEX(N(1)->r.fill, 0x00ff00);
+    CHECK_DIMEQ(TARGET(1), PX_DIM(40.0, 20.0));
+    CHECK_POSEQ(COORD(3), PX_POS(110.0, 0.0));
+
+    CHECK_IEQ(ax_write(s, "(patch 2 (text \"Hi\") (grow 1))"), 0);
+    SYNC();
+    CHECK_STREQ(N(2)->t.text, "Hi");
+    CHECK_SZEQ(N(2)->t.lines[0].len, (size_t) 2);
+    CHECK_DIMEQ(TARGET(2), PX_DIM(150.0, 20.0));
+
+    CHECK_IEQ(ax_write(s, "(patch 0 (main-justify end))"), 0);
+    CHECK_IEQ(ax_write(s, "(patch 0 (fill \"000000\"))"), 1);
+    CHECK_STREQ(ax_get_error(s), "patch: not a node with those attributes");
+    CHECK_IEQ(ax_write(s, "(patch 7 (grow 1))"), 1);
+    ax_destroy_state(s);
+}
+
+TEST(small_trees_start_no_workers)
+{
+    struct ax_state* s = ax_new_state();
+    ax__set_layout_workers(s->geom, 4);
+    ax_write(s,
+             "(init (window-size 200 100))"
+             "(set-root (container (children (rect (size 10 10)) (text \"Foo\"))))");
+    SYNC();
+    CHECK_SZEQ(s->geom->n_workers, (size_t) 1);
+    CHECK_FALSE(s->geom->workers_started);
+    ax_destroy_state(s);
+}
+
+TEST(patch_text_outside_region)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 200 100))"
+             "(set-root (container (children (text \"Foo bar\"))))");
+    SYNC();
+    CHECK_IEQ(ax_write(s, "(patch 1 (text \"Hello there world\"))"), 0);
+    SYNC();
+    char* alloc_ptr = s->tree->rgn.alloc_ptr;
+    for (int i = 0; i < 100; i++) {
+        CHECK_IEQ(ax_write(s, i % 2 ? "(patch 1 (text \"Hi there\"))"
+                                     : "(patch 1 (text \"Hello there world\"))"), 0);
+        SYNC();
+    }
+    CHECK_STREQ(N(1)->t.text, "Hi there");
+    CHECK(N(1)->t.text == N(1)->t.patched_text, "text was patched in");
+    CHECK(s->tree->rgn.alloc_ptr == alloc_ptr, "patches don't allocate in the region");
+    ax_destroy_state(s);
+}
+
+TEST(layout_visits_dirty_spine)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 1000 1000))");
+    ax_write_string(s, "(set-root (container (children");
+    ax_write_string(s, "(container (children (text \"Foo bar\")))");
+    for (int i = 0; i < 50; i++) {
+        ax_write_string(s, "(rect (size 10 10))");
+    }
+    ax_write_string(s, ")))");
+    CHECK_IEQ(ax_write_end(s), 0);
+    SYNC();
+    struct growable* work = &s->geom->workers[0].work;
+    CHECK_SZEQ(LEN(work, node_id), (size_t) 53);
+
+    // only the root and the last rect
+    CHECK_IEQ(ax_write(s, "(patch 51 (size 20 10))"), 0);
+    SYNC();
+    CHECK_SZEQ(LEN(work, node_id), (size_t) 2);
+    CHECK_DIMEQ(TARGET(0), PX_DIM(1000.0, 1000.0));
+    CHECK_DIMEQ(HYPOTH(0), PX_DIM(580.0, 10.0));
+
+    // the rects and the text keep their hypothetical sizes, so only the containers and
+    // the rects that move to the second line are visited
+    ax__set_dim(s, PX_DIM(500.0, 500.0));
+    SYNC();
+    CHECK_POSEQ(COORD(51), PX_POS(60.0, 10.0));
+    CHECK_SZEQ(LEN(work, node_id), (size_t) 2 + 7);
+    ax_destroy_state(s);
+}
+
+TEST(identical_subtrees_share_layout)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 100 1000))");
+    ax_write_string(s, "(set-root (container (children");
+    for (int i = 0; i < 20; i++) {
+        // (the colors differ, but they don't matter for the layout)
+        ax_write_string(s, i % 2 ? "(container (children (rect (size 10 10))" :
+                        "(container (children (rect (size 10 10) (fill \"ff0000\"))");
+        ax_write_string(s, " (text \"Foo bar baz\")))");
+    }
+    ax_write_string(s, ")))");
+    CHECK_IEQ(ax_write_end(s), 0);
+    SYNC();
+    // the root and one cell; one text wrap
+    CHECK_SZEQ(s->geom->workers[0].hypoth_memo.count, (size_t) 2);
+    CHECK_SZEQ(s->geom->workers[0].wrap_memo.count, (size_t) 1);
+    CHECK_DIMEQ(HYPOTH(3), PX_DIM(80.0, 20.0));
+    CHECK_SZEQ(N(26)->t.n_lines, (size_t) 2);
+    CHECK_POSEQ(COORD(26), PX_POS(10.0, 40.0));
+    CHECK_POSEQ(N(26)->t.lines[1].coord, PX_POS(10.0, 50.0));
+    CHECK_SZEQ(N(26)->t.lines[1].offset, (size_t) 8);
+    ax_destroy_state(s);
+}
+
+TEST(text_outside_window_culled)
+{
+    // ten text nodes of two lines each, one per row. half of them fit in the window.
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 100 100))");
+    ax_write_string(s, "(set-root (container (children");
+    for (int i = 0; i < 10; i++) {
+        ax_write_string(s, "(text \"Foo bar baz qux\" (font \"size:10\"))");
+    }
+    ax_write_string(s, ")))");
+    CHECK_IEQ(ax_write_end(s), 0);
+    SYNC();
+    CHECK_FALSE(N(5)->t.culled);
+    CHECK_POSEQ(N(5)->t.lines[1].coord, PX_POS(0.0, 90.0));
+    CHECK_TRUE(N(6)->t.culled);
+    CHECK_POSEQ(COORD(10), PX_POS(0.0, 180.0));
+    CHECK_TRUE(N(10)->t.culled);
+    CHECK_DIMEQ(s->tree->extent[0].s, PX_DIM(100.0, 200.0));
+
+    // the nodes don't move, but they're uncovered
+    ax__set_dim(s, PX_DIM(100.0, 300.0));
+    SYNC();
+    CHECK_FALSE(N(10)->t.culled);
+    CHECK_POSEQ(N(10)->t.lines[1].coord, PX_POS(0.0, 190.0));
+    ax_destroy_state(s);
+}
+
+TEST(text_left_of_window_culled)
+{
+    // the line overflows to the left of the window, so the text ends before it starts
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 100 100))"
+             "(set-root"
+             " (container (children (text \"Foo bar\" (font \"size:10\") (shrink 0))"
+             "                      (rect (size 300 10) (shrink 0))"
+             "                      (text \"Baz\" (font \"size:10\") (shrink 0)))"
+             "            single-line (main-justify end)))");
+    SYNC();
+    CHECK_POSEQ(COORD(1), PX_POS(-300.0, 0.0));
+    CHECK_TRUE(N(1)->t.culled);
+    CHECK_POSEQ(COORD(3), PX_POS(70.0, 0.0));
+    CHECK_FALSE(N(3)->t.culled);
+    CHECK_POSEQ(N(3)->t.lines[0].coord, PX_POS(70.0, 0.0));
+    ax_destroy_state(s);
+}
+
+TEST(list_places_only_its_rows)
+{
+    // a million items, of which only the rows of items 3 and 4 exist
+    struct ax_state* s = ax_new_state();
+    ax_write(s,
+             "(init (window-size 100 100))"
+             "(set-root"
+             " (container (children"
+             "  (rect (size 100 30))"
+             "  (list (children (rect (size 10 10)) (rect (size 10 10)))"
+             "        (items 1000000) (item-size 10) (first-item 3)))))");
+    SYNC();
+    CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 5);
+    CHECK_IEQ(N(2)->ty, AX_NODE_LIST);
+    CHECK_DIMEQ(HYPOTH(2), PX_DIM(100.0, 10000000.0));
+    CHECK_POSEQ(COORD(2), PX_POS(0.0, 30.0));
+    CHECK_DIMEQ(TARGET(3), PX_DIM(100.0, 10.0));
+    CHECK_POSEQ(COORD(3), PX_POS(0.0, 60.0));
+    CHECK_POSEQ(COORD(4), PX_POS(0.0, 70.0));
+
+    // the window shows items 0-6, and 4 more are wanted below them
+    CHECK_SZEQ(LEN(&s->geom->row_requests, struct ax_event), (size_t) 1);
+    const struct ax_event* e = s->geom->row_requests.data;
+    CHECK_IEQ(e->ty, AX_EVENT_ROWS);
+    CHECK_SZEQ(e->rows.id, (size_t) 2);
+    CHECK_SZEQ(e->rows.first, (size_t) 0);
+    CHECK_SZEQ(e->rows.count, (size_t) 11);
+    ax_destroy_state(s);
+}
+
+static bool same_layout(struct ax_tree* a, struct ax_tree* b)
+{
+    if (ax__tree_count(a) != ax__tree_count(b)) {
+        return false;
+    }
+    for (node_id id = 0; id < ax__tree_count(a); id++) {
+        if (memcmp(&a->hypoth[id], &b->hypoth[id], sizeof(struct ax_dim)) != 0 ||
+            memcmp(&a->target[id], &b->target[id], sizeof(struct ax_dim)) != 0 ||
+            memcmp(&a->coord[id], &b->coord[id], sizeof(struct ax_pos)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_row_requests(struct ax_geom* a, struct ax_geom* b)
+{
+    size_t n = LEN(&a->row_requests, struct ax_event);
+    if (n != LEN(&b->row_requests, struct ax_event)) {
+        return false;
+    }
+    const struct ax_event* ea = a->row_requests.data;
+    const struct ax_event* eb = b->row_requests.data;
+    for (size_t i = 0; i < n; i++) {
+        if (ea[i].rows.id != eb[i].rows.id ||
+            ea[i].rows.first != eb[i].rows.first ||
+            ea[i].rows.count != eb[i].rows.count)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(parallel_layout_matches_serial)
+{
+    // 200 cells of 50 children, some of them text that wraps, and every fourth one with a
+    // list
+    struct ax_state* states[2];
+    for (int k = 0; k < 2; k++) {
+        struct ax_state* s = states[k] = ax_new_state();
+        ax__set_layout_workers(s->geom, k == 0 ? 1 : 4);
+        ax_write_start(s);
+        ax_write_string(s, "(init (window-size 600 1000))");
+        ax_write_string(s, "(set-root (container (children");
+        for (int i = 0; i < 200; i++) {
+            ax_write_string(s, "(container (children");
+            for (int j = 0; j < 50; j++) {
+                ax_write_string(s, j % 10 ? "(rect (size 20 20) (grow 1))" :
+                                "(text \"Foo bar baz qux\")");
+            }
+            if (i % 4 == 0) {
+                ax_write_string(s, "(list (children) (items 100) (item-size 5))");
+            }
+            ax_write_string(s, ") (main-justify between))");
+        }
+        ax_write_string(s, ")))");
+        CHECK_IEQ(ax_write_end(s), 0);
+        CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 10251);
+        ax__async_wait_for_layout(s->async);
+    }
+    CHECK(same_layout(states[0]->tree, states[1]->tree), "initial layout");
+    CHECK_SZEQ(states[1]->geom->n_workers, (size_t) 4);
+    CHECK(LEN(&states[0]->geom->row_requests, struct ax_event) > 1, "lists in the window");
+    CHECK(same_row_requests(states[0]->geom, states[1]->geom), "initial row requests");
+
+    for (int k = 0; k < 2; k++) {
+        struct ax_state* s = states[k];
+        ax__set_dim(s, PX_DIM(450.0, 1000.0));
+        SYNC();
+    }
+    CHECK(same_layout(states[0]->tree, states[1]->tree), "after resize");
+
+    for (int k = 0; k < 2; k++) {
+        struct ax_state* s = states[k];
+        CHECK_IEQ(ax_write(s, "(patch 300 (size 70 20))"), 0);
+        SYNC();
+    }
+    CHECK(same_layout(states[0]->tree, states[1]->tree), "after patch");
+
+    ax_destroy_state(states[0]);
+    ax_destroy_state(states[1]);
+}
+
+static void run_flex_kernels(const struct ax_flex_kernels* fk,
+                             const ax_length* main, const ax_length* cross,
+                             const ax_length* grow, const ax_length* shrink,
+                             size_t n, ax_length* out)
+{
+    ax_length main_sum, cross_max;
+    fk->line_sums(main, cross, n, &main_sum, &cross_max);
+    ax_length free_space = AX_LENGTH(1000.0) - main_sum;
+    ax_length* factor = malloc(sizeof(ax_length) * n);
+    ax_length factor_sum = fk->factors(main, grow, shrink, n, free_space < 0, factor);
+    fk->targets(main, factor, n, free_space, factor_sum, out);
+    out[n] = main_sum;
+    out[n + 1] = cross_max;
+    out[n + 2] = factor_sum;
+    free(factor);
+}
+
+TEST(flex_kernels_match_scalar)
+{
+    const struct ax_flex_kernels* sc = &ax__flex_scalar_kernels;
+    ax_length main[] = {
+        AX_LENGTH(10.0), AX_LENGTH(20.0), AX_LENGTH(30.0),
+        AX_LENGTH(40.0), AX_LENGTH(50.0), AX_LENGTH(60.0),
+    };
+    ax_length cross[] = {
+        AX_LENGTH(1.0), AX_LENGTH(5.0), AX_LENGTH(2.0),
+        AX_LENGTH(4.0), AX_LENGTH(3.0), AX_LENGTH(0.0),
+    };
+    ax_length grow[] = { 1.0, 0.0, 1.0, 2.0, 0.0, 0.0 };
+    ax_length shrink[] = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+    ax_length out[6 + 3];
+    run_flex_kernels(sc, main, cross, grow, shrink, 6, out);
+    CHECK_LENEQ(out[6], 210.0);
+    CHECK_LENEQ(out[7], 5.0);
+    CHECK_FLEQ(0.001, (double) out[8], 4.0); // (a sum of grow factors, not a length)
+    CHECK_LENEQ(out[0], 10.0 + 790.0 / 4);
+    CHECK_LENEQ(out[1], 20.0);
+    CHECK_LENEQ(out[3], 40.0 + 790.0 / 2);
+
+    const struct ax_flex_kernels* avx2 = ax__flex_avx2_kernels();
+    if (avx2 == NULL) {
+        return;
+    }
+    // lengths that aren't multiples of the vector width, both growing and shrinking
+    size_t max_n = 1003;
+    ax_length* bufs = malloc(sizeof(ax_length) * max_n * 6 + sizeof(ax_length) * 6);
+    ax_length* m = bufs;
+    ax_length* c = m + max_n;
+    ax_length* g = c + max_n;
+    ax_length* sh = g + max_n;
+    ax_length* out_sc = sh + max_n;
+    ax_length* out_avx2 = out_sc + max_n + 3;
+    srand(1);
+    for (size_t i = 0; i < max_n; i++) {
+        m[i] = AX_LENGTH((rand() % 10000) / 7.0);
+        c[i] = AX_LENGTH((rand() % 10000) / 3.0);
+        g[i] = rand() % 3;
+        sh[i] = rand() % 3;
+    }
+    bool same = true;
+    for (size_t n = 0; n <= max_n; n += 59) {
+        run_flex_kernels(sc, m, c, g, sh, n, out_sc);
+        run_flex_kernels(avx2, m, c, g, sh, n, out_avx2);
+        same = same && memcmp(out_sc, out_avx2, sizeof(ax_length) * (n + 3)) == 0;
+    }
+    for (size_t n = 1; n <= 8; n++) {
+        run_flex_kernels(sc, m, c, g, sh, n, out_sc);
+        run_flex_kernels(avx2, m, c, g, sh, n, out_avx2);
+        same = same && memcmp(out_sc, out_avx2, sizeof(ax_length) * (n + 3)) == 0;
+    }
+    CHECK(same, "avx2 and scalar results differ");
+    free(bufs);
+}
+
+TEST(flex_kernels_saturate)
+{
+    // (in fixed point, these would overflow)
+    const struct ax_flex_kernels* sc = &ax__flex_scalar_kernels;
+    ax_length main[] = {
+        AX_LENGTH_MAX, AX_LENGTH_MAX, AX_LENGTH_MAX, AX_LENGTH_MAX, AX_LENGTH_MAX,
+    };
+    ax_length cross[] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    ax_length grow[] = { 1.0, 1.0, 1.0, 1.0, 1.0 };
+    ax_length shrink[] = { 2.0, 2.0, 2.0, 2.0, 2.0 };
+    ax_length factor[5], out[5];
+    ax_length main_sum, cross_max;
+    sc->line_sums(main, cross, 5, &main_sum, &cross_max);
+    CHECK(!(main_sum < AX_LENGTH_MAX), "sum of main sizes should saturate");
+    ax_length factor_sum = sc->factors(main, grow, shrink, 5, true, factor);
+    CHECK(!(factor[0] < AX_LENGTH_MAX), "shrink factor should saturate");
+    CHECK(!(factor_sum < AX_LENGTH_MAX), "sum of factors should saturate");
+    factor_sum = sc->factors(main, grow, shrink, 5, false, factor);
+    sc->targets(main, factor, 5, AX_LENGTH(100.0), factor_sum, out);
+    CHECK(!(out[4] < AX_LENGTH_MAX), "target should saturate");
+}
+
+TEST(tall_text_saturates)
+{
+    // (100 lines of a million pixels, which is more than fits in fixed point)
+    struct growable buf;
+    ax__init_growable(&buf, 256);
+    ax__growable_clear_str(&buf);
+    ax__growable_push_str(&buf,
+                          "(init (window-size 100 100))"
+                          "(set-root (text \"a");
+    for (int i = 1; i < 100; i++) {
+        ax__growable_push_str(&buf, "\na");
+    }
+    ax__growable_push_str(&buf, "\" (font \"size:1000000\")))");
+
+    struct ax_state* s = ax_new_state();
+    CHECK_IEQ(ax_write(s, buf.data), 0);
+    SYNC();
+    CHECK_SZEQ(N(0)->t.n_lines, (size_t) 100);
+    CHECK(!(HYPOTH(0).h < AX_LENGTH(33000000.0)), "height should saturate");
+    CHECK(!(N(0)->t.lines[99].coord.y < N(0)->t.lines[98].coord.y),
+          "line coords should saturate");
+    ax_destroy_state(s);
+    ax__free_growable(&buf);
+}
+
+TEST(text_file_mapped)
+{
+    // (the text starts past the first page, so the mapping offset has to be aligned)
+    char path[] = "/tmp/ax_test_text_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK_TRUE(fd >= 0);
+    char pad[5000];
+    memset(pad, 'x', sizeof(pad));
+    CHECK_IEQ((int) write(fd, pad, sizeof(pad)), (int) sizeof(pad));
+    CHECK_IEQ((int) write(fd, "Foo bar baz\nHello world", 23), 23);
+    close(fd);
+
+    char input[256];
+    snprintf(input, sizeof(input),
+             "(init (window-size 100 100))"
+             "(set-root (text-file \"%s\" 5000 17 (font \"size:10\")))", path);
+    struct ax_state* s = ax_new_state();
+    CHECK_IEQ(ax_write(s, input), 0);
+    SYNC();
+    CHECK_TRUE(N(0)->t.map != NULL);
+    CHECK_SZEQ(N(0)->t.text_len, (size_t) 17);
+    CHECK_STRNEQ(N(0)->t.text, N(0)->t.text_len, "Foo bar baz\nHello");
+    CHECK_SZEQ(N(0)->t.n_lines, (size_t) 3);
+    CHECK_SZEQ(N(0)->t.lines[2].offset, (size_t) 12);
+    CHECK_SZEQ(N(0)->t.lines[2].len, (size_t) 5);
+
+    // appending copies the text out of the mapping
+    CHECK_IEQ(ax_write(s, "(append-text 0 \" again\")"), 0);
+    SYNC();
+    CHECK_STREQ(N(0)->t.text, "Foo bar baz\nHello again");
+    CHECK_SZEQ(N(0)->t.n_lines, (size_t) 4);
+
+    // the range is clamped to the end of the file
+    snprintf(input, sizeof(input),
+             "(set-root (text-file \"%s\" 5012 1000 (font \"size:10\")))", path);
+    CHECK_IEQ(ax_write(s, input), 0);
+    SYNC();
+    CHECK_STRNEQ(N(0)->t.text, N(0)->t.text_len, "Hello world");
+
+    unlink(path);
+    CHECK_IEQ(ax_write(s, input), 1);
+    ax_destroy_state(s);
+}
+
+#ifndef AX_TEST_NO_STRESS_TESTS
+static double elapsed_ms(struct timespec t0, struct timespec t1)
+{
+    return (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// a node with its geometry and topology, as they were stored before they were split into
+// the tree's parallel arrays
+struct aos_node {
+    struct ax_node props;
+    struct ax_dim avail, hypoth, target;
+    struct ax_pos coord;
+    node_id first_child, n_children;
+};
+#endif
+
+TEST(layout_100k_nodes_stress_test)
+{
+#ifndef AX_TEST_NO_STRESS_TESTS
+    // 1000 containers of 99 rects each. relayout is timed by resizing the window.
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 800 600))");
+    ax_write_string(s, "(set-root (container (children");
+    for (int i = 0; i < 1000; i++) {
+        ax_write_string(s, "(container (children");
+        for (int j = 0; j < 99; j++) {
+            ax_write_string(s, "(rect (size 20 20) (grow 1))");
+        }
+        ax_write_string(s, "))");
+    }
+    ax_write_string(s, ")))");
+    CHECK_IEQ(ax_write_end(s), 0);
+    CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 100001);
+    SYNC();
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < 20; i++) {
+        ax__set_dim(s, PX_DIM(800 + i, 600));
+        SYNC();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("[BENCH] layout of 100k nodes: %.2f ms\n", elapsed_ms(t0, t1) / 20);
+
+    // placing the children of every node, the way the layout's downward pass does: with
+    // the geometry in parallel arrays (how the tree stores it), and in an array of whole
+    // nodes (how it was stored before)
+    struct ax_tree* tr = s->tree;
+    size_t n = ax__tree_count(tr);
+    struct ax_pos* coord = malloc(sizeof(struct ax_pos) * n);
+    struct aos_node* aos = malloc(sizeof(struct aos_node) * n);
+    CHECK(coord != NULL && aos != NULL, "malloc nodes");
+    memcpy(coord, tr->coord, sizeof(struct ax_pos) * n);
+    for (node_id id = 0; id < n; id++) {
+        aos[id] = (struct aos_node) {
+            .props = *ax__node_by_id(tr, id),
+            .avail = tr->avail[id], .hypoth = tr->hypoth[id],
+            .target = tr->target[id], .coord = tr->coord[id],
+            .first_child = tr->first_child[id], .n_children = tr->n_children[id],
+        };
+    }
+    double soa_ms = 0.0, aos_ms = 0.0;
+    for (int i = 0; i < 20; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (node_id id = 0; id < n; id++) {
+            ax_length x = coord[id].x;
+            node_id end = tr->first_child[id] + tr->n_children[id];
+            for (node_id c = tr->first_child[id]; c < end; c++) {
+                coord[c].x = x;
+                x += tr->target[c].w;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        soa_ms += elapsed_ms(t0, t1);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (node_id id = 0; id < n; id++) {
+            ax_length x = aos[id].coord.x;
+            node_id end = aos[id].first_child + aos[id].n_children;
+            for (node_id c = aos[id].first_child; c < end; c++) {
+                aos[c].coord.x = x;
+                x += aos[c].target.w;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        aos_ms += elapsed_ms(t0, t1);
+    }
+    bool same = true;
+    for (node_id id = 0; id < n; id++) {
+        same = same && !(aos[id].coord.x < coord[id].x) && !(aos[id].coord.x > coord[id].x);
+    }
+    free(aos);
+    free(coord);
+    CHECK(same, "both placements should agree");
+    printf("[BENCH] placing 100k nodes: %.3f ms as arrays, %.3f ms as structs\n",
+           soa_ms / 20, aos_ms / 20);
     ax_destroy_state(s);
+#endif
 }
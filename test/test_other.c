@@ -100,3 +100,24 @@ TEST(build_big_tree)
     CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 1001);
     ax_destroy_state(s);
 }
+
+TEST(build_deep_tree)
+{
+    // far deeper than the parser's initial context stack
+    struct ax_state* s = ax_new_state();
+    ax_write_start(s);
+    ax_write_string(s, "(init (window-size 200 200))");
+    ax_write_string(s, "(set-root ");
+    for (int i = 0; i < 2000; i++) {
+        ax_write_string(s, "(container (children ");
+    }
+    ax_write_string(s, "(rect (size 20 20))");
+    for (int i = 0; i < 2000; i++) {
+        ax_write_string(s, "))");
+    }
+    ax_write_string(s, ")");
+    CHECK_IEQ(ax_write_end(s), 0);
+    CHECK_SZEQ(ax__tree_count(s->tree), (size_t) 2001);
+    CHECK_IEQ(ax__node_by_id(s->tree, 2000)->ty, AX_NODE_RECTANGLE);
+    ax_destroy_state(s);
+}
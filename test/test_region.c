@@ -90,14 +90,14 @@ TEST(grow_structs)
 {
     struct growable g;
     ax__init_growable(&g, DEFAULT_CAPACITY);
-    for (int i = 0; i < 100; i++) { PUSH(&g, &AX_DIM(i, i * 0.5)); }
+    for (int i = 0; i < 100; i++) { PUSH(&g, &PX_DIM(i, i * 0.5)); }
     struct ax_dim* dims = g.data;
-    for (int i = 0; i < 100; i++) { CHECK_DIMEQ(dims[i], AX_DIM(i, i * 0.5)); }
+    for (int i = 0; i < 100; i++) { CHECK_DIMEQ(dims[i], PX_DIM(i, i * 0.5)); }
     ax__growable_clear(&g);
     CHECK_TRUE(ax__is_growable_empty(&g));
-    for (int i = 0; i < 50; i++) { PUSH(&g, &AX_DIM(i, i * 0.3)); }
+    for (int i = 0; i < 50; i++) { PUSH(&g, &PX_DIM(i, i * 0.3)); }
     dims = g.data;
-    for (int i = 0; i < 50; i++) { CHECK_DIMEQ(dims[i], AX_DIM(i, i * 0.3)); }
+    for (int i = 0; i < 50; i++) { CHECK_DIMEQ(dims[i], PX_DIM(i, i * 0.3)); }
     ax__free_growable(&g);
 }
 
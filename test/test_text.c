@@ -4,69 +4,75 @@
 #include "../src/backend.h"
 #include "../src/core.h"
 #include "../src/core/region.h"
+#include "../src/core/async.h"
+#include "../src/tree.h"
+#include "../src/geom/font.h"
+#include "../src/geom/measure.h"
+
+#define CHECK_SPAN(_ti, _span, _str)                                \
+    CHECK_STRNEQ(ax__text_span_str(&(_ti), (_ti)._span),            \
+                 (_ti)._span.len, _str)
+
+#define CHECK_LINE(_ti, _str) do {                                      \
+        char _line[256];                                                \
+        size_t _len = ax__text_line_copy(ax__text_span_str(&(_ti), (_ti).line), \
+                                         (_ti).line.len, _line);        \
+        CHECK_STRNEQ(_line, _len, _str);                                \
+    } while (0)
 
 TEST(text_3_words)
 {
-    struct region rgn;
     struct ax_text_iter ti;
     enum ax_text_elem e;
-    ax__init_region(&rgn);
-    ax__text_iter_init(&rgn, &ti, "Foo bar, baz.");
+    ax__text_iter_init(&ti, "Foo bar, baz.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Foo");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Foo");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "bar,");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "bar,");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "baz.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "baz.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_END); CHECK_STREQ(ti.line, "Foo bar, baz.");
-    ax__free_region(&rgn);
+    CHECK_IEQ(e, AX_TEXT_END); CHECK_LINE(ti, "Foo bar, baz.");
 }
 
 
 TEST(text_3_words_big_spaces)
 {
-    struct region rgn;
     struct ax_text_iter ti;
     enum ax_text_elem e;
-    ax__init_region(&rgn);
-    ax__text_iter_init(&rgn, &ti, "   Foo bar,  baz.  ");
+    ax__text_iter_init(&ti, "   Foo bar,  baz.  ");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Foo");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Foo");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "bar,");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "bar,");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "baz.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "baz.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_END); CHECK_STREQ(ti.line, "Foo bar, baz.");
-    ax__free_region(&rgn);
+    CHECK_IEQ(e, AX_TEXT_END); CHECK_LINE(ti, "Foo bar, baz.");
 }
 
 
 TEST(text_linebreak_chars)
 {
-    struct region rgn;
     struct ax_text_iter ti;
     enum ax_text_elem e;
-    ax__init_region(&rgn);
-    ax__text_iter_init(&rgn, &ti, "Foo bar,\nbaz. \n \nBang.");
+    ax__text_iter_init(&ti, "Foo bar,\nbaz. \n \nBang.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Foo");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Foo");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "bar,");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "bar,");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "Foo bar,");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "Foo bar,");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "baz.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "baz.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "baz.");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "baz.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Bang.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Bang.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_END); CHECK_STREQ(ti.line, "Bang.");
-    ax__free_region(&rgn);
+    CHECK_IEQ(e, AX_TEXT_END); CHECK_LINE(ti, "Bang.");
 }
 
 
@@ -75,29 +81,226 @@ TEST(text_linebreak_width)
     struct ax_state* s = ax_new_state();
     ax_write(s, "(init)");
     struct ax_font* f;
-    ax__new_font(s, s->backend, "size:10", &f);
+    ax__acquire_font(s, s->backend, "size:10", &f);
     struct ax_text_iter ti;
     enum ax_text_elem e;
-    ax__text_iter_init(&s->init_rgn, &ti, "Foo bar baz bang. Superlongword.");
+    ax__text_iter_init(&ti, "Foo bar baz bang. Superlongword.");
     ax__text_iter_set_font(&ti, f);
-    ti.max_width = 80;
+    ti.max_width = AX_LENGTH(80);
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Foo");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Foo");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "bar");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "bar");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "Foo bar");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "Foo bar");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "baz");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "baz");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "baz");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "baz");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "bang.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "bang.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_STREQ(ti.line, "bang.");
+    CHECK_IEQ(e, AX_TEXT_EOL); CHECK_LINE(ti, "bang.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_STREQ(ti.word, "Superlongword.");
+    CHECK_IEQ(e, AX_TEXT_WORD); CHECK_SPAN(ti, word, "Superlongword.");
     e = ax__text_iter_next(&ti);
-    CHECK_IEQ(e, AX_TEXT_END); CHECK_STREQ(ti.line, "Superlongword.");
+    CHECK_IEQ(e, AX_TEXT_END); CHECK_LINE(ti, "Superlongword.");
+    ax__release_font(f);
+    ax_destroy_state(s);
+}
+
+
+TEST(font_cache_shares_handles)
+{
+    struct ax_state* s = ax_new_state();
+    struct ax_font_cache_stats st0, st1, st2;
+    ax__font_cache_stats(&st0);
+    ax_write(s,
+             "(init)"
+             "(set-root"
+             " (container"
+             "  (children (text \"a\" (font \"size:13\"))"
+             "            (text \"b\" (font \"size:14\"))"
+             "            (text \"c\" (font \"size:13\")))))");
+    ax__async_wait_for_layout(s->async);
+    struct ax_font* f13 = ax__node_by_id(s->tree, 1)->t.font;
+    struct ax_font* f14 = ax__node_by_id(s->tree, 2)->t.font;
+    CHECK_PEQ(ax__node_by_id(s->tree, 3)->t.font, f13);
+    CHECK_TRUE(f13 != f14);
+    ax__font_cache_stats(&st1);
+    CHECK_SZEQ(st1.hits - st0.hits, (size_t) 1);
+
+    // the same fonts survive a new set-root
+    ax_write(s,
+             "(set-root"
+             " (container"
+             "  (children (text \"d\" (font \"size:14\"))"
+             "            (text \"e\" (font \"size:13\")))))");
+    ax__async_wait_for_layout(s->async);
+    CHECK_PEQ(ax__node_by_id(s->tree, 1)->t.font, f14);
+    CHECK_PEQ(ax__node_by_id(s->tree, 2)->t.font, f13);
+    ax__font_cache_stats(&st2);
+    CHECK_SZEQ(st2.misses, st1.misses);
+    CHECK_SZEQ(st2.hits - st1.hits, (size_t) 2);
+    ax_destroy_state(s);
+}
+
+TEST(measure_cache_hits_and_evicts)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s, "(init)");
+    struct ax_font* f;
+    ax__acquire_font(s, s->backend, "size:7", &f);
+    struct ax_measure_cache_stats st0, st1, st2;
+    struct ax_text_metrics tm;
+
+    // (non-ASCII, so that it isn't measured from the font's advance table)
+    const char* str = "h\xc3\xa9llo, cache";
+    ax__measure_cache_stats(&st0);
+    ax__measure_text_cached(f, str, 13, &tm);
+    CHECK_LENEQ(tm.width, 91.0);
+    ax__measure_text_cached(f, str, 13, &tm);
+    CHECK_LENEQ(tm.width, 91.0);
+    ax__measure_cache_stats(&st1);
+    CHECK_SZEQ(st1.misses - st0.misses, (size_t) 1);
+    CHECK_SZEQ(st1.hits - st0.hits, (size_t) 1);
+
+    // overflowing the capacity evicts the least recently used entry
+    char buf[32];
+    for (size_t i = 0; i < AX_MEASURE_CACHE_CAPACITY; i++) {
+        ax__measure_text_cached(f, buf, sprintf(buf, "\xc3\xa9%zu", i), &tm);
+    }
+    ax__measure_cache_stats(&st2);
+    CHECK_TRUE(st2.evictions > st1.evictions);
+    CHECK_TRUE(st2.n_entries <= AX_MEASURE_CACHE_CAPACITY);
+    ax__measure_text_cached(f, str, 13, &tm);
+    ax__measure_cache_stats(&st1);
+    CHECK_SZEQ(st1.misses - st2.misses, (size_t) 1);
+
+    ax__release_font(f);
+    ax_destroy_state(s);
+}
+
+static ax_length counting_measure_fn(const char* str, size_t len, void* ud)
+{
+    (void) str;
+    size_t* n_measured = ud;
+    *n_measured += len;
+    return len;
+}
+
+TEST(text_wrap_linear_long_paragraph)
+{
+    // 5000 words of 4 characters each, wrapped at 80 columns. measuring the whole line
+    // prefix for each word would touch ~40x more characters than this allows.
+    const size_t n_words = 5000;
+    struct region rgn;
+    ax__init_region(&rgn);
+    char* text = ALLOCATES(&rgn, char, n_words * 5 + 1);
+    for (size_t i = 0; i < n_words; i++) {
+        memcpy(&text[i * 5], "word ", 5);
+    }
+    text[n_words * 5] = '\0';
+
+    size_t n_measured = 0, n_lines = 0;
+    struct ax_text_iter ti;
+    ax__text_iter_init(&ti, text);
+    ti.mf = counting_measure_fn;
+    ti.mf_userdata = &n_measured;
+    ti.max_width = 80;
+    enum ax_text_elem e;
+    do {
+        e = ax__text_iter_next(&ti);
+        if (e != AX_TEXT_WORD) {
+            CHECK_TRUE(ti.line_width <= 80);
+            n_lines++;
+        }
+    } while (e != AX_TEXT_END);
+
+    CHECK_SZEQ(n_lines, (size_t) (n_words / 16 + (n_words % 16 != 0)));
+    CHECK_TRUE(n_measured < 4 * strlen(text));
+    ax__free_region(&rgn);
+}
+
+TEST(text_segment_words)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s, "(init)");
+    struct ax_font* f;
+    ax__acquire_font(s, s->backend, "size:10", &f);
+    const char* text = "Foo  bar,\nbaz. \n \nBang.\n";
+    size_t n = ax__text_segment(text, strlen(text), NULL, NULL);
+    CHECK_SZEQ(n, (size_t) 5);
+    struct ax_text_word words[5];
+    CHECK_SZEQ(ax__text_segment(text, strlen(text), f, words), (size_t) 5);
+    CHECK_STRNEQ(text + words[0].offset, words[0].len, "Foo");
+    CHECK_STRNEQ(text + words[1].offset, words[1].len, "bar,");
+    CHECK_STRNEQ(text + words[2].offset, words[2].len, "baz.");
+    CHECK_STRNEQ(text + words[3].offset, words[3].len, "Bang.");
+    CHECK_SZEQ(words[4].len, (size_t) 0);
+    CHECK_SZEQ(words[0].newlines, (size_t) 0);
+    CHECK_SZEQ(words[1].newlines, (size_t) 0);
+    CHECK_SZEQ(words[2].newlines, (size_t) 1);
+    CHECK_SZEQ(words[3].newlines, (size_t) 2);
+    CHECK_SZEQ(words[4].newlines, (size_t) 1);
+    CHECK_LENEQ(words[1].width, 40.0);
+    CHECK_LENEQ(words[1].gap_width, 10.0); // (drawn with a single space)
+    CHECK_LENEQ(words[3].width, 50.0);
+    ax__release_font(f);
+    ax_destroy_state(s);
+}
+
+TEST(measure_from_advance_table)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s, "(init)");
+    struct ax_font* f;
+    ax__acquire_font(s, s->backend, "size:9", &f);
+    const struct ax_font_metrics* fm = ax__font_metrics(f);
+    CHECK_LENEQ(fm->line_spacing, 9.0);
+    CHECK_LENEQ(fm->advances['a'], 9.0);
+
+    struct ax_measure_cache_stats st0, st1;
+    struct ax_text_metrics tm;
+    ax__measure_cache_stats(&st0);
+    ax__measure_text_cached(f, "abc def", 7, &tm);
+    CHECK_LENEQ(tm.width, 63.0);
+    CHECK_LENEQ(tm.text_height, 9.0);
+    ax__measure_cache_stats(&st1);
+    CHECK_SZEQ(st1.hits, st0.hits);
+    CHECK_SZEQ(st1.misses, st0.misses);
+    ax__release_font(f);
+    ax_destroy_state(s);
+}
+
+TEST(measure_text_batch)
+{
+    struct ax_state* s = ax_new_state();
+    ax_write(s, "(init)");
+    struct ax_font* f;
+    ax__acquire_font(s, s->backend, "size:5", &f);
+
+    // two non-ASCII spans (cache misses), one ASCII span and one empty span
+    const char* text = "\xc3\xa9t\xc3\xa9 abc \xc3\xa0 b";
+    struct ax_text_span spans[] = { { 0, 5 }, { 6, 3 }, { 10, 2 }, { 12, 0 } };
+    ax_length widths[4];
+    struct ax_measure_cache_stats st0, st1;
+    ax__measure_cache_stats(&st0);
+    ax__measure_text_batch_cached(f, text, spans, 4, widths);
+    CHECK_LENEQ(widths[0], 25.0);
+    CHECK_LENEQ(widths[1], 15.0);
+    CHECK_LENEQ(widths[2], 10.0);
+    CHECK_LENEQ(widths[3], 0.0);
+    ax__measure_cache_stats(&st1);
+    CHECK_SZEQ(st1.misses - st0.misses, (size_t) 2);
+
+    // second time around, the misses are now hits
+    ax__measure_text_batch_cached(f, text, spans, 4, widths);
+    CHECK_LENEQ(widths[0], 25.0);
+    ax__measure_cache_stats(&st0);
+    CHECK_SZEQ(st0.misses, st1.misses);
+    CHECK_SZEQ(st0.hits - st1.hits, (size_t) 2);
+
+    ax__release_font(f);
     ax_destroy_state(s);
 }